@@ -0,0 +1,2833 @@
+#include "OSM2MIFLib.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <stdio.h>
+#include <chrono>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+
+#define LINE_BUFFER_LENGTH 100000
+
+// Read a line from an input stream
+bool GetLineFromFile(istream& In, char* szBuffer, char*& szLine, bool fAllowEmptyLine)
+{
+	szLine = NULL;
+    if (In.eof ())
+        return false;
+    In.getline (szBuffer, LINE_BUFFER_LENGTH);
+    if (strlen (szBuffer) == LINE_BUFFER_LENGTH || (!fAllowEmptyLine && strlen (szBuffer) == 0))
+        return false;
+	szLine = szBuffer;
+	return true;
+}
+
+bool GetLineFromFile(istream& In, char*& szLine, bool fAllowEmptyLine)
+{
+	static char szBuffer[LINE_BUFFER_LENGTH];
+	return GetLineFromFile(In, szBuffer, szLine, fAllowEmptyLine);
+}
+
+// Convert a string to a long, returning false if conversion failed
+bool ConvertTextTolong(const char* szValue, long& lValue)
+{
+	char* szEnd;
+	errno = 0;
+	lValue = strtol(szValue, &szEnd, 10);
+	return errno != ERANGE;
+}
+
+// Convert a string to a double, returning false if conversion failed
+bool ConvertTextToDouble(const char* szValue, double& dblValue)
+{
+	char* szEnd;
+	errno = 0;
+	dblValue = strtod(szValue, &szEnd);
+	return errno != ERANGE;
+}
+
+
+// Parameters file:
+//  * Reads in a file of key/allowed values where the key must match the values to be passed through to the mid/mif (iv = "included values")
+//        e.g. k="highway" iv="residential" iv="secondary" iv="primary"
+//             or: k="highway" iv="*"    ['*' is a wildcard, so all key value pairs starting with k="highway" will be passed through.  
+//											If k="highway" is not in the record at all, it won't be passed through.]
+//  * Key/disallowed values: if the key matches one of the values, it is not passed through: (ev = "excluded values")
+//        e.g. k="route" ev="ferry" ev="ski" ev="bicycle"
+//             or: k="route" ev="*"    ['*' is a wildcard, so all key value pairs starting with k="route" will not be passed through]
+//  * Style: Key-included value pairs that, if they match, specify particular pen colour/style/width to use in the mif file
+//        e.g. k="waterway" iv="river" style="Pen(3,2,65438)"
+//             k="waterway" iv="*" style="Pen(3,2,65438)"    ['*' is a wildcard matching all unmatched values]
+//  * Style: Key-included value pairs that, if they match, specify a transformed value to use instead of the original value: (tv = "transformed value")
+//        e.g. k="waterway" iv="river" tv="1"
+//  * Break up: Whether to break up polylines/regions at intersections - the default is to do this breakup, but it is really only relevant for streets to produce a routable topology.
+//        e.g. k="waterway" break_up="no" to switch off breaking up for waterways
+//  Note you can't specify k="key" v="*" for both allowed and disallowed where 'key' is the same in both.
+//  * Type: for each column (usually Integer or Char(100), Char(250) etc) - use type="..."
+//		  e.g. k="oneway" iv="*" type="Integer"
+//  * Mif_type: default mif type is PolyLine ("Pline") but rivers, lakes, admin boundaries etc should be regions
+//         (Mif types are: point, line, polyline, region, arc, text, rectangle, rounded rectangle, ellipse, multipoint, collection)
+//        e.g. k="natural" iv="water" style="Pen(3,2,255)" mif_type="Region" break_up="no"
+//  * Simplify: Key-included value pairs that, if they match, have their polylines/regions simplified (Douglas-Peucker) before being
+//		  written.  The tolerance is in degrees; intersection nodes and the ends of each polyline are always kept.
+//        e.g. k="natural" iv="coastline" simplify="0.0005"
+//		  A simplify given with iv="*" applies to every value of the key that has no tolerance of its own.
+//
+//  Also, specific key values specified are always respected (ie. they override the wildcard).
+//
+// Possible todo's:
+//   * Allow further rectangles specifying excluded regions specified by lat/long rects
+
+bool ReadParametersFile(string strParametersFile, double& min_lon, double& min_lat, double& max_lon, double& max_lat, 
+						map<string, ParameterValues*>& mapIncludedValues, map<string, ParameterValues*>& mapExcludedValues, string& strError)
+{
+	ifstream in;
+	in.open(strParametersFile.c_str());
+	if (!in.good())
+		return false;
+
+	char* s;
+	while (GetLineFromFile(in, s, true))
+	{
+		string str(s);
+
+		string strCurrentKey, strCurrentIncludedValue;
+		ParameterValues* CurrentIncludedValues = NULL, * CurrentExcludedValues = NULL;
+		bool fFirst = true, fCurrentKeyIsMandatory = false;
+
+		while (!str.empty())
+		{
+			if (str.length() >= 2 && str.substr(0, 2) == "//")
+				break;
+
+			int eq = str.find("=\"");
+			int ve = str.find("\"", eq + 2);
+			if (eq == str.npos && ve == str.npos)
+				break;
+			if (eq == str.npos || ve == str.npos)
+			{
+				strError = "Error in \'" + str + "\'";
+				return false;
+			}
+			string strKey = str.substr(0, eq), strValue = str.substr(eq + 2, ve - eq - 2);
+			if (strKey.empty() || strValue.empty())
+			{
+				strError = "Error in \'" + str + "\'";
+				return false;
+			}
+
+			if (fFirst)
+			{
+				strCurrentKey = "";
+				CurrentIncludedValues = NULL;
+				CurrentExcludedValues = NULL;
+
+				if (strKey == "min_lon")
+				{
+					if (!ConvertTextToDouble(strValue.c_str(), min_lon))
+					{
+						strError = "Error in \'" + str + "\': value is not a lat/long";
+						return false;
+					}
+				}
+				else if (strKey == "max_lon")
+				{
+					if (!ConvertTextToDouble(strValue.c_str(), max_lon))
+					{
+						strError = "Error in \'" + str + "\': value is not a lat/long";
+						return false;
+					}
+				}
+				else if (strKey == "min_lat")
+				{
+					if (!ConvertTextToDouble(strValue.c_str(), min_lat))
+					{
+						strError = "Error in \'" + str + "\': value is not a lat/long";
+						return false;
+					}
+				}
+				else if (strKey == "max_lat")
+				{
+					if (!ConvertTextToDouble(strValue.c_str(), max_lat))
+					{
+						strError = "Error in \'" + str + "\': value is not a lat/long";
+						return false;
+					}
+				}
+				else if (strKey == "k" || strKey == "mk")
+				{
+					strCurrentKey = strValue;
+					fCurrentKeyIsMandatory = (strKey == "mk");
+				}
+				else
+				{
+					strError = "Error in \'" + str + "\': unrecognised key";
+					return false;
+				}
+			}
+			else
+			{
+				if (strKey == "iv")
+				{
+					if (CurrentIncludedValues == NULL)
+					{
+						if (mapIncludedValues.find(strCurrentKey) != mapIncludedValues.end())
+							CurrentIncludedValues = mapIncludedValues.find(strCurrentKey)->second;
+						else
+						{
+							CurrentIncludedValues = new ParameterValues(fCurrentKeyIsMandatory);
+							mapIncludedValues[strCurrentKey] = CurrentIncludedValues;
+						}
+					}
+					if (strValue == "*")
+						CurrentIncludedValues->m_fIsAll = true;
+					else
+						CurrentIncludedValues->m_setValues.insert(strValue);
+					strCurrentIncludedValue = strValue;
+				}
+				if (strKey == "ev")
+				{
+					if (CurrentExcludedValues == NULL)
+					{
+						if (mapExcludedValues.find(strCurrentKey) != mapExcludedValues.end())
+							CurrentExcludedValues = mapExcludedValues.find(strCurrentKey)->second;
+						else
+						{
+							CurrentExcludedValues = new ParameterValues;
+							mapExcludedValues[strCurrentKey] = CurrentExcludedValues;
+						}
+					}
+					if (strValue == "*")
+						CurrentExcludedValues->m_fIsAll = true;
+					else
+						CurrentExcludedValues->m_setValues.insert(strValue);
+				}
+				if (strKey == "style")
+					CurrentIncludedValues->m_mapDrawStyle[strCurrentIncludedValue] = strValue;
+				if (strKey == "tv")
+					CurrentIncludedValues->m_mapTransform[strCurrentIncludedValue] = strValue;
+				if (strKey == "mif_type")
+					CurrentIncludedValues->m_mapMifType[strCurrentIncludedValue] = strValue;
+				if (strKey == "type")
+				{
+					if (CurrentIncludedValues->m_mapTypes.find(strCurrentKey) != CurrentIncludedValues->m_mapTypes.end())
+					{
+						strError = "Error in \'" + str + "\': type defined twice for " + strCurrentKey;
+						return false;
+					}
+					CurrentIncludedValues->m_mapTypes[strCurrentKey] = strValue;
+				}
+				if (strKey == "break_up" && strValue == "no")
+					CurrentIncludedValues->m_mapBreakUp[strCurrentKey] = strValue;
+				if (strKey == "simplify")
+				{
+					double dblTolerance;
+					if (!ConvertTextToDouble(strValue.c_str(), dblTolerance) || dblTolerance < 0)
+					{
+						strError = "Error in \'" + str + "\': simplify tolerance is not a valid distance";
+						return false;
+					}
+					CurrentIncludedValues->m_mapSimplifyTolerance[strCurrentIncludedValue] = dblTolerance;
+				}
+			}
+
+			if (ve + 2 >= (int)str.length())
+				break;
+			else
+				str = str.substr(ve + 2);
+			fFirst = false;
+		}
+	}
+
+	in.close();
+
+	// number the output columns
+	int nColumn = 0;
+	for (map<string, ParameterValues*>::iterator itKey = mapIncludedValues.begin(); itKey != mapIncludedValues.end(); itKey++)
+		itKey->second->m_nColumn = nColumn++;
+	return true;
+}
+
+// XML parsing helper function
+string ReplaceApostrophesAndAmpersands(string str)
+{
+	size_t nFind = 0;
+	string strFind = "&apos;", strReplace = "'";
+	for (; (nFind = str.find(strFind, nFind)) != string::npos; )
+	{
+		str.replace(nFind, strFind.length(), strReplace);
+		nFind += strReplace.length();
+	}
+	nFind = 0;
+	strFind = "&amp;";
+	strReplace = "&";
+	for (; (nFind = str.find(strFind, nFind)) != string::npos; )
+	{
+		str.replace(nFind, strFind.length(), strReplace);
+		nFind += strReplace.length();
+	}
+	return str;
+}
+
+void WriteMidRecord(ostream& outMid, OSM2MIFSpan<string> values, bool fWriteRelations, const string& strRelationData)
+{
+	int j = 0;
+	for (const string* itValue = values.begin(); itValue != values.end(); itValue++, j++)
+	{
+		if (j > 0)
+			outMid << ",";
+		outMid << "\"" << ReplaceApostrophesAndAmpersands(*itValue) << "\"";
+	}
+
+	if (fWriteRelations)
+		outMid << "," << strRelationData;
+	outMid << endl;
+}
+
+void WriteMidMifRecord(ostream& outMid, ostream& outMif, const string& strMifTypeForThisWay, const string& strStyleForThisWay, 
+					   const vector<pair<double,double> >& latlons, OSM2MIFSpan<string> values_in_current_way, bool fWriteRelations, const string& strRelationData)
+{
+	if (strMifTypeForThisWay == "Region" || strMifTypeForThisWay == "region")
+		outMif << "Region 1" << endl << "  " << latlons.size() << endl;
+	else
+		outMif << "Pline " << latlons.size() << endl;
+
+	for (vector<pair<double,double> >::const_iterator itLatLon = latlons.begin(); itLatLon != latlons.end(); itLatLon++)
+		outMif << setprecision(15) << itLatLon->second << " " << itLatLon->first << endl;
+
+	outMif << "	" << strStyleForThisWay << endl;
+
+	WriteMidRecord(outMid, values_in_current_way, fWriteRelations, strRelationData);
+}
+
+// Write a multi-ring region (outer rings, each followed by its inner rings) and its mid record
+void WriteMidMifRegionRecord(ostream& outMid, ostream& outMif, const string& strStyle, OSM2MIFSpan<vector<pair<double,double> > > rings,
+							 OSM2MIFSpan<string> values, bool fWriteRelations, const string& strRelationData)
+{
+	outMif << "Region " << rings.size() << endl;
+	for (const vector<pair<double,double> >* itRing = rings.begin(); itRing != rings.end(); itRing++)
+	{
+		outMif << "  " << itRing->size() << endl;
+		for (vector<pair<double,double> >::const_iterator itLatLon = itRing->begin(); itLatLon != itRing->end(); itLatLon++)
+			outMif << setprecision(15) << itLatLon->second << " " << itLatLon->first << endl;
+	}
+
+	outMif << "	" << strStyle << endl;
+
+	WriteMidRecord(outMid, values, fWriteRelations, strRelationData);
+}
+
+// Grow a lon/lat bounding box to include a polyline/ring
+void ExtendBounds(const vector<pair<double,double> >& latlons, double& min_lon, double& min_lat, double& max_lon, double& max_lat)
+{
+	for (vector<pair<double,double> >::const_iterator itLatLon = latlons.begin(); itLatLon != latlons.end(); itLatLon++)
+	{
+		min_lon = min(min_lon, itLatLon->second);
+		max_lon = max(max_lon, itLatLon->second);
+		min_lat = min(min_lat, itLatLon->first);
+		max_lat = max(max_lat, itLatLon->first);
+	}
+}
+
+// Position of a lon/lat along a Hilbert curve covering the whole world at 2^31 x 2^31 resolution
+unsigned long long HilbertIndex(double lon, double lat)
+{
+	const unsigned int n = 1u << 31;
+	unsigned int x = (unsigned int)min((double)(n - 1), max(0.0, (lon + 180.0) / 360.0 * n));
+	unsigned int y = (unsigned int)min((double)(n - 1), max(0.0, (lat + 90.0) / 180.0 * n));
+
+	unsigned long long d = 0;
+	for (unsigned int s = n / 2; s > 0; s /= 2)
+	{
+		unsigned int rx = (x & s) > 0, ry = (y & s) > 0;
+		d += (unsigned long long)s * s * ((3 * rx) ^ ry);
+
+		// rotate the quadrant so the curve stays continuous
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = s - 1 - (x & (s - 1));
+				y = s - 1 - (y & (s - 1));
+			}
+			unsigned int t = x;
+			x = y;
+			y = t;
+		}
+		x &= s - 1;
+		y &= s - 1;
+	}
+	return d;
+}
+
+// Receives the mid/mif records as they are produced.  By default they go straight to the mid/mif files, in the order of the ways
+// in the osm file.  With Hilbert sorting switched on, each record is formatted into a buffer instead and keyed by the Hilbert index
+// of its bounding box centre; when the buffer passes its size limit it is sorted and spilled to a temporary run file, and Finish()
+// merges the runs into the mid/mif files.  The mid and mif text of a record always travel together, so the files stay in lockstep.
+class MidMifRecordWriter
+{
+public:
+	MidMifRecordWriter(ofstream& outMid, ofstream& outMif) : m_outMid(outMid), m_outMif(outMif)
+	{
+		m_fSort = false;
+		m_nMaxBufferBytes = 0;
+		m_nBufferBytes = 0;
+		m_nSequence = 0;
+		m_nRunFilesWritten = 0;
+	}
+
+	~MidMifRecordWriter()
+	{
+		RemoveRunFiles();
+	}
+
+	void EnableHilbertSort(const string& strRunFilePrefix, size_t nMaxBufferBytes)
+	{
+		m_fSort = true;
+		m_strRunFilePrefix = strRunFilePrefix;
+		m_nMaxBufferBytes = nMaxBufferBytes;
+	}
+
+	// the streams the next record should be written to
+	ostream& Mid() { return m_fSort ? (ostream&)m_bufMid : (ostream&)m_outMid; }
+	ostream& Mif() { return m_fSort ? (ostream&)m_bufMif : (ostream&)m_outMif; }
+
+	// called once the record for these lat/longs (or rings) has been written to Mid() and Mif()
+	bool EndRecord(const vector<pair<double,double> >& latlons, string& strError)
+	{
+		if (!m_fSort)
+			return true;
+		double min_lon = 1e30, min_lat = 1e30, max_lon = -1e30, max_lat = -1e30;
+		ExtendBounds(latlons, min_lon, min_lat, max_lon, max_lat);
+		return AddRecord(HilbertIndex((min_lon + max_lon) / 2, (min_lat + max_lat) / 2), strError);
+	}
+	bool EndRecord(OSM2MIFSpan<vector<pair<double,double> > > rings, string& strError)
+	{
+		if (!m_fSort)
+			return true;
+		double min_lon = 1e30, min_lat = 1e30, max_lon = -1e30, max_lat = -1e30;
+		for (const vector<pair<double,double> >* itRing = rings.begin(); itRing != rings.end(); itRing++)
+			ExtendBounds(*itRing, min_lon, min_lat, max_lon, max_lat);
+		return AddRecord(HilbertIndex((min_lon + max_lon) / 2, (min_lat + max_lat) / 2), strError);
+	}
+
+	// write out whatever is still buffered or spilled, in Hilbert order
+	bool Finish(string& strError)
+	{
+		if (!m_fSort)
+			return true;
+
+		sort(m_records.begin(), m_records.end());
+		if (m_runFiles.empty())
+		{
+			for (vector<SortRecord>::iterator it = m_records.begin(); it != m_records.end(); it++)
+			{
+				m_outMid << it->m_strMid;
+				m_outMif << it->m_strMif;
+			}
+			m_records.clear();
+			return true;
+		}
+
+		if (!m_records.empty() && !SpillRun(strError))
+			return false;
+
+		// k-way merge of the sorted runs.  Each run is read for exactly the number of records spilled to it, so a run file that
+		// cannot be opened or comes back short is an error rather than an early end of that run.
+		vector<ifstream*> runs;
+		vector<SortRecord> heads(m_runFiles.size());
+		vector<unsigned long long> records_left(m_runRecords);
+		priority_queue<pair<pair<unsigned long long, unsigned long long>, int>, vector<pair<pair<unsigned long long, unsigned long long>, int> >,
+					   greater<pair<pair<unsigned long long, unsigned long long>, int> > > queue;
+		bool fOk = true;
+		for (int i = 0; fOk && i < (int)m_runFiles.size(); i++)
+		{
+			runs.push_back(new ifstream(m_runFiles[i].c_str(), ios::binary));
+			if (!runs[i]->good())
+			{
+				strError = "Could not open " + m_runFiles[i] + " for reading";
+				fOk = false;
+			}
+			else if (records_left[i] > 0)
+			{
+				fOk = ReadRecord(*runs[i], m_runFiles[i], heads[i], strError);
+				records_left[i]--;
+				if (fOk)
+					queue.push(make_pair(make_pair(heads[i].m_key, heads[i].m_sequence), i));
+			}
+		}
+		while (fOk && !queue.empty())
+		{
+			int i = queue.top().second;
+			queue.pop();
+			m_outMid << heads[i].m_strMid;
+			m_outMif << heads[i].m_strMif;
+			if (records_left[i] > 0)
+			{
+				fOk = ReadRecord(*runs[i], m_runFiles[i], heads[i], strError);
+				records_left[i]--;
+				if (fOk)
+					queue.push(make_pair(make_pair(heads[i].m_key, heads[i].m_sequence), i));
+			}
+		}
+		for (int i = 0; i < (int)runs.size(); i++)
+			delete runs[i];
+
+		RemoveRunFiles();
+		return fOk;
+	}
+
+	int RunFilesWritten() { return m_nRunFilesWritten; }
+
+private:
+	class SortRecord
+	{
+	public:
+		unsigned long long m_key, m_sequence;	// the sequence number keeps records with the same key in their original order
+		string m_strMid, m_strMif;
+		bool operator<(const SortRecord& other) const
+		{
+			return m_key < other.m_key || (m_key == other.m_key && m_sequence < other.m_sequence);
+		}
+	};
+
+	bool AddRecord(unsigned long long key, string& strError)
+	{
+		m_records.push_back(SortRecord());
+		SortRecord& record = m_records.back();
+		record.m_key = key;
+		record.m_sequence = m_nSequence++;
+		record.m_strMid = m_bufMid.str();
+		record.m_strMif = m_bufMif.str();
+		m_bufMid.str("");
+		m_bufMif.str("");
+
+		m_nBufferBytes += sizeof(SortRecord) + record.m_strMid.size() + record.m_strMif.size();
+		if (m_nBufferBytes < m_nMaxBufferBytes)
+			return true;
+
+		sort(m_records.begin(), m_records.end());
+		return SpillRun(strError);
+	}
+
+	// write the (sorted) buffered records to a new run file
+	bool SpillRun(string& strError)
+	{
+		stringstream strRunFile;
+		strRunFile << m_strRunFilePrefix << m_runFiles.size() << ".tmp";
+		ofstream out(strRunFile.str().c_str(), ios::binary | ios::trunc);
+		if (!out.good())
+		{
+			strError = "Could not open " + strRunFile.str() + " for writing";
+			return false;
+		}
+		m_runFiles.push_back(strRunFile.str());
+		m_runRecords.push_back(m_records.size());
+		m_nRunFilesWritten++;
+
+		for (vector<SortRecord>::iterator it = m_records.begin(); it != m_records.end(); it++)
+		{
+			unsigned int nMidLength = (unsigned int)it->m_strMid.size(), nMifLength = (unsigned int)it->m_strMif.size();
+			out.write((const char*)&it->m_key, sizeof(it->m_key));
+			out.write((const char*)&it->m_sequence, sizeof(it->m_sequence));
+			out.write((const char*)&nMidLength, sizeof(nMidLength));
+			out.write(it->m_strMid.data(), nMidLength);
+			out.write((const char*)&nMifLength, sizeof(nMifLength));
+			out.write(it->m_strMif.data(), nMifLength);
+		}
+		if (!out.good())
+		{
+			strError = "Could not write to " + strRunFile.str();
+			return false;
+		}
+
+		m_records.clear();
+		m_nBufferBytes = 0;
+		return true;
+	}
+
+	// read the next record of a run; the caller knows how many records the run holds, so any short read is an error
+	bool ReadRecord(ifstream& in, const string& strRunFile, SortRecord& record, string& strError)
+	{
+		unsigned int nLength = 0;
+		in.read((char*)&record.m_key, sizeof(record.m_key));
+		in.read((char*)&record.m_sequence, sizeof(record.m_sequence));
+		in.read((char*)&nLength, sizeof(nLength));
+		if (in.good())
+		{
+			record.m_strMid.resize(nLength);
+			if (nLength > 0)
+				in.read(&record.m_strMid[0], nLength);
+			in.read((char*)&nLength, sizeof(nLength));
+		}
+		if (in.good())
+		{
+			record.m_strMif.resize(nLength);
+			if (nLength > 0)
+				in.read(&record.m_strMif[0], nLength);
+		}
+		if (!in.good())
+		{
+			strError = "Could not read a record back from " + strRunFile;
+			return false;
+		}
+		return true;
+	}
+
+	void RemoveRunFiles()
+	{
+		for (vector<string>::iterator it = m_runFiles.begin(); it != m_runFiles.end(); it++)
+			remove(it->c_str());
+		m_runFiles.clear();
+		m_runRecords.clear();
+	}
+
+	ofstream& m_outMid, & m_outMif;
+	bool m_fSort;
+	string m_strRunFilePrefix;
+	size_t m_nMaxBufferBytes, m_nBufferBytes;
+	unsigned long long m_nSequence;
+	int m_nRunFilesWritten;
+	ostringstream m_bufMid, m_bufMif;
+	vector<SortRecord> m_records;
+	vector<string> m_runFiles;
+	vector<unsigned long long> m_runRecords;	// the number of records spilled to each run file
+};
+
+// Simplify a polyline/region in place with an iterative Douglas-Peucker (explicit stack rather than recursion).
+// The first and last nodes and any node flagged in 'fixed' (intersections) are always kept, and 'fixed' is compacted alongside 'latlons'.
+// Returns the number of nodes removed.
+int SimplifyLatLons(vector<pair<double,double> >& latlons, vector<bool>& fixed, double dblTolerance, bool fIsRegion)
+{
+	int n = (int)latlons.size();
+	if (n < 3 || dblTolerance <= 0)
+		return 0;
+
+	vector<bool> keep(n, false);
+	vector<pair<int,int> > stack;
+	double dblToleranceSquared = dblTolerance * dblTolerance;
+
+	// split the line at the fixed nodes first, then simplify each run between them
+	int first = 0;
+	keep[0] = true;
+	for (int i = 1; i < n; i++)
+	{
+		if (i == n - 1 || fixed[i])
+		{
+			keep[i] = true;
+			if (i - first > 1)
+				stack.push_back(pair<int,int>(first, i));
+			first = i;
+		}
+	}
+
+	while (!stack.empty())
+	{
+		int from = stack.back().first, to = stack.back().second;
+		stack.pop_back();
+
+		// distances are measured in lon/lat space from the chord from..to (or from the point itself if the run is a closed ring)
+		double x1 = latlons[from].second, y1 = latlons[from].first;
+		double dx = latlons[to].second - x1, dy = latlons[to].first - y1;
+		double dblLengthSquared = dx * dx + dy * dy;
+
+		int farthest = -1;
+		double dblFarthestSquared = dblToleranceSquared;
+		for (int i = from + 1; i < to; i++)
+		{
+			double px = latlons[i].second - x1, py = latlons[i].first - y1;
+			double dblDistanceSquared;
+			if (dblLengthSquared == 0)
+				dblDistanceSquared = px * px + py * py;
+			else
+			{
+				double cross = px * dy - py * dx;
+				dblDistanceSquared = cross * cross / dblLengthSquared;
+			}
+			if (dblDistanceSquared > dblFarthestSquared)
+			{
+				dblFarthestSquared = dblDistanceSquared;
+				farthest = i;
+			}
+		}
+
+		if (farthest >= 0)
+		{
+			keep[farthest] = true;
+			if (farthest - from > 1)
+				stack.push_back(pair<int,int>(from, farthest));
+			if (to - farthest > 1)
+				stack.push_back(pair<int,int>(farthest, to));
+		}
+	}
+
+	int nKept = 0;
+	for (int i = 0; i < n; i++)
+		if (keep[i])
+			nKept++;
+
+	// a region must keep at least a triangle plus its closing node
+	if (nKept == n || (fIsRegion && nKept < 4))
+		return 0;
+
+	int j = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (keep[i])
+		{
+			latlons[j] = latlons[i];
+			fixed[j] = fixed[i];
+			j++;
+		}
+	}
+	latlons.resize(j);
+	fixed.resize(j);
+	return n - j;
+}
+
+double AngleBetweenIntersectingLines(double dblLine1XFrom, double dblLine1YFrom, double dblLine1XTo, double dblLine1YTo, 
+									 double dblLine2XFrom, double dblLine2YFrom, double dblLine2XTo, double dblLine2YTo)
+{
+	// create vectors (delta x and delta y) out of the lines
+	double dblX1 = dblLine1XTo - dblLine1XFrom, dblY1 = dblLine1YTo - dblLine1YFrom;
+	double dblX2 = dblLine2XTo - dblLine2XFrom, dblY2 = dblLine2YTo - dblLine2YFrom;
+
+	// now calc angles
+	double angle1 = atan2(dblY1, dblX1);		// Angle made with the horizontal
+	double angle2 = atan2(dblY2, dblX2);		// Angle made with the horizontal
+	const double radians_to_degrees = 57.29577951289617186797;
+	double degrees = radians_to_degrees*(angle2 - angle1);		// Angle between lines
+
+	// Convert to lie interval [-360,360]
+	int sign = (degrees < 0 ? -1 : (degrees == 0 ? 0 : 1));
+	degrees = fabs(degrees);
+	degrees = (degrees - 360*( ((long)degrees)/((long)360) ));
+
+	return sign * (degrees <= 180.0 ? degrees : (degrees - 360.0));
+}
+
+bool IsRightTurn(double dblLine1XFrom, double dblLine1YFrom, double dblLine1XTo, double dblLine1YTo, 
+				 double dblLine2XFrom, double dblLine2YFrom, double dblLine2XTo, double dblLine2YTo)
+{
+	return AngleBetweenIntersectingLines(dblLine1XFrom, dblLine1YFrom, dblLine1XTo, dblLine1YTo, 
+		 								 dblLine2XFrom, dblLine2YFrom, dblLine2XTo, dblLine2YTo) < 0;
+}
+
+// Zig-zag varints, for the deltas in the compressed NodeStore: small positive and negative numbers both take few bytes
+static void PutVarint(unsigned char*& p, long long n)
+{
+	unsigned long long u = ((unsigned long long)n << 1) ^ (unsigned long long)(n >> 63);
+	while (u >= 0x80)
+	{
+		*p++ = (unsigned char)(u | 0x80);
+		u >>= 7;
+	}
+	*p++ = (unsigned char)u;
+}
+
+static long long GetVarint(const unsigned char*& p)
+{
+	unsigned long long u = 0;
+	int nShift = 0;
+	while (*p & 0x80)
+	{
+		u |= (unsigned long long)(*p++ & 0x7F) << nShift;
+		nShift += 7;
+	}
+	u |= (unsigned long long)(*p++) << nShift;
+	return (long long)(u >> 1) ^ -(long long)(u & 1);
+}
+
+static int ToFixedPoint(double dblDegrees)
+{
+	return (int)floor(dblDegrees * 1e7 + 0.5);
+}
+
+NodeStore::NodeStore(bool fCompress) : m_fCompress(fCompress), m_nSize(0), m_nChunkBytesUsed(CHUNK_BYTES)
+{
+	m_pending.m_nBlock = -1;
+	m_pending.m_nNodes = 0;
+}
+
+NodeStore::~NodeStore()
+{
+	for (vector<unsigned char*>::iterator it = m_chunks.begin(); it != m_chunks.end(); it++)
+		delete[] *it;
+}
+
+void NodeStore::Add(long id, double lat, double lon)
+{
+	if (!m_fCompress)
+	{
+		if (m_mapNodes.insert(make_pair(id, pair<double,double>(lat, lon))).second)
+			m_nSize++;
+		else
+			m_mapNodes[id] = pair<double,double>(lat, lon);
+		return;
+	}
+
+	// ids must go up for the deltas; anything else (including a repeated id, which replaces the earlier location) goes in the map
+	long last_id = (m_pending.m_nNodes > 0 ? m_pending.m_ids[m_pending.m_nNodes - 1] : (!m_blocks.empty() ? m_blocks.back().m_last_id : LONG_MIN));
+	if (id <= last_id)
+	{
+		pair<double,double> latlon;
+		if (!Find(id, latlon))
+			m_nSize++;
+		m_mapNodes[id] = pair<double,double>(ToFixedPoint(lat) / 1e7, ToFixedPoint(lon) / 1e7);
+		return;
+	}
+
+	m_pending.m_ids[m_pending.m_nNodes] = id;
+	m_pending.m_lats[m_pending.m_nNodes] = ToFixedPoint(lat);
+	m_pending.m_lons[m_pending.m_nNodes] = ToFixedPoint(lon);
+	m_pending.m_nNodes++;
+	m_nSize++;
+	if (m_pending.m_nNodes == BLOCK_NODES)
+		EncodeBlock();
+}
+
+void NodeStore::EncodeBlock()
+{
+	// at most 3 varints of 10 bytes for each node
+	unsigned char buffer[BLOCK_NODES * 30];
+	unsigned char* p = buffer;
+	for (int i = 1; i < m_pending.m_nNodes; i++)
+	{
+		PutVarint(p, (long long)m_pending.m_ids[i] - m_pending.m_ids[i - 1]);
+		PutVarint(p, (long long)m_pending.m_lats[i] - m_pending.m_lats[i - 1]);
+		PutVarint(p, (long long)m_pending.m_lons[i] - m_pending.m_lons[i - 1]);
+	}
+	size_t nBytes = p - buffer;
+	if (m_nChunkBytesUsed + nBytes > CHUNK_BYTES)
+	{
+		m_chunks.push_back(new unsigned char[CHUNK_BYTES]);
+		m_nChunkBytesUsed = 0;
+	}
+	unsigned char* pData = m_chunks.back() + m_nChunkBytesUsed;
+	memcpy(pData, buffer, nBytes);
+	m_nChunkBytesUsed += nBytes;
+
+	Block block;
+	block.m_first_id = m_pending.m_ids[0];
+	block.m_last_id = m_pending.m_ids[m_pending.m_nNodes - 1];
+	block.m_lat = m_pending.m_lats[0];
+	block.m_lon = m_pending.m_lons[0];
+	block.m_pData = pData;
+	block.m_nNodes = m_pending.m_nNodes;
+	m_blocks.push_back(block);
+	m_pending.m_nNodes = 0;
+}
+
+void NodeStore::DecodeBlock(int nBlock, DecodedBlock& decoded)
+{
+	const Block& block = m_blocks[nBlock];
+	const unsigned char* p = block.m_pData;
+	decoded.m_nBlock = nBlock;
+	decoded.m_nNodes = block.m_nNodes;
+	decoded.m_ids[0] = block.m_first_id;
+	decoded.m_lats[0] = block.m_lat;
+	decoded.m_lons[0] = block.m_lon;
+	for (int i = 1; i < block.m_nNodes; i++)
+	{
+		decoded.m_ids[i] = (long)(decoded.m_ids[i - 1] + GetVarint(p));
+		decoded.m_lats[i] = (int)(decoded.m_lats[i - 1] + GetVarint(p));
+		decoded.m_lons[i] = (int)(decoded.m_lons[i - 1] + GetVarint(p));
+	}
+}
+
+bool NodeStore::FindInBlock(const DecodedBlock& block, long id, pair<double,double>& latlon)
+{
+	const long* pFound = lower_bound(block.m_ids, block.m_ids + block.m_nNodes, id);
+	if (pFound == block.m_ids + block.m_nNodes || *pFound != id)
+		return false;
+	latlon.first = block.m_lats[pFound - block.m_ids] / 1e7;
+	latlon.second = block.m_lons[pFound - block.m_ids] / 1e7;
+	return true;
+}
+
+bool NodeStore::Find(long id, pair<double,double>& latlon)
+{
+	if (!m_mapNodes.empty())
+	{
+		map<long, pair<double,double> >::iterator itFind = m_mapNodes.find(id);
+		if (itFind != m_mapNodes.end())
+		{
+			latlon = itFind->second;
+			return true;
+		}
+	}
+	if (!m_fCompress)
+		return false;
+
+	if (m_pending.m_nNodes > 0 && id >= m_pending.m_ids[0])
+		return FindInBlock(m_pending, id, latlon);
+
+	// the last block starting at or before id
+	int nLow = 0, nHigh = (int)m_blocks.size() - 1;
+	if (nHigh < 0 || id < m_blocks[0].m_first_id)
+		return false;
+	while (nLow < nHigh)
+	{
+		int nMiddle = (nLow + nHigh + 1) / 2;
+		if (m_blocks[nMiddle].m_first_id <= id)
+			nLow = nMiddle;
+		else
+			nHigh = nMiddle - 1;
+	}
+	if (id > m_blocks[nLow].m_last_id)
+		return false;
+
+	if (m_cache.empty())
+	{
+		m_cache.resize(CACHED_BLOCKS);
+		for (vector<DecodedBlock>::iterator it = m_cache.begin(); it != m_cache.end(); it++)
+			it->m_nBlock = -1;
+	}
+	DecodedBlock& decoded = m_cache[nLow % CACHED_BLOCKS];
+	if (decoded.m_nBlock != nLow)
+		DecodeBlock(nLow, decoded);
+	return FindInBlock(decoded, id, latlon);
+}
+
+pair<double,double> NodeStore::LatLon(long id)
+{
+	pair<double,double> latlon(0, 0);
+	Find(id, latlon);
+	return latlon;
+}
+
+long long NodeStore::MemoryBytes()
+{
+	// a map entry is the key and value plus about four pointers' worth of tree node
+	return (long long)m_mapNodes.size() * (sizeof(pair<const long, pair<double,double> >) + 4 * sizeof(void*))
+		   + (long long)m_chunks.size() * CHUNK_BYTES + (long long)m_blocks.capacity() * sizeof(Block)
+		   + (long long)m_cache.size() * sizeof(DecodedBlock) + sizeof(NodeStore);
+}
+
+// Function to try and pull out banned right turn
+string GetRelationData(RelationsItPair& itRelations, map<long, vector<long> >& nodes_in_each_way, 
+					   long id_of_from_way, int nUptoNodeInFromWay,
+					   NodeStore& nodes,
+					   int& nRelationsWritten, int& nRelationsFound, bool fLookAtNextNodeInWayToDetermineIfIsRightTurn)
+{
+	if (nUptoNodeInFromWay < 0)
+		return "";
+
+	stringstream str;
+
+	for (multimap<long,Relation*>::iterator itRel = itRelations.first; itRel != itRelations.second; itRel++)
+	{
+		long node_id = nodes_in_each_way[id_of_from_way][nUptoNodeInFromWay];
+
+		if (itRel->second->m_node_via_id == node_id)
+		{
+			nRelationsFound++;
+
+			// we need to find the next or previous node in the 'to' way
+			long from_node_id_in_to_way = -1, to_node_id_in_to_way = -1;
+			for (vector<long>::iterator it = nodes_in_each_way[itRel->second->m_to_way_id].begin(); it != nodes_in_each_way[itRel->second->m_to_way_id].end(); it++)
+				if (*it == itRel->second->m_node_via_id && it != nodes_in_each_way[itRel->second->m_to_way_id].end() - 1)
+				{
+					from_node_id_in_to_way = *it;
+					to_node_id_in_to_way = *(++it);
+					break;
+				}
+				else if (*it == node_id && it != nodes_in_each_way[itRel->second->m_to_way_id].begin())
+				{
+					from_node_id_in_to_way = *it;
+					to_node_id_in_to_way = *(--it);
+					break;
+				}
+
+			if (from_node_id_in_to_way >= 0 && to_node_id_in_to_way >= 0)
+			{
+				long prev_node_id = nodes_in_each_way[id_of_from_way][nUptoNodeInFromWay - 1];
+				pair<double,double> prev = nodes.LatLon(prev_node_id), via = nodes.LatLon(node_id);
+				pair<double,double> from_in_to_way = nodes.LatLon(from_node_id_in_to_way), to_in_to_way = nodes.LatLon(to_node_id_in_to_way);
+
+				if (!fLookAtNextNodeInWayToDetermineIfIsRightTurn 
+					&&
+					IsRightTurn(prev.second, prev.first,
+								via.second, via.first,
+								from_in_to_way.second, from_in_to_way.first,
+								to_in_to_way.second, to_in_to_way.first))
+				{
+					str << (str.str().length() > 1 ? ";" : "") << itRel->second->m_to_way_id;
+					nRelationsWritten++;
+				}
+				else if (fLookAtNextNodeInWayToDetermineIfIsRightTurn 
+						&& 
+						nUptoNodeInFromWay < (int)nodes_in_each_way[id_of_from_way].size() - 1)
+				{
+					int next_node_id = nodes_in_each_way[id_of_from_way][nUptoNodeInFromWay + 1];
+					pair<double,double> next = nodes.LatLon(next_node_id);
+
+					if (IsRightTurn(next.second, next.first,
+									via.second, via.first,
+									from_in_to_way.second, from_in_to_way.first,
+									to_in_to_way.second, to_in_to_way.first))
+					{
+						str << (str.str().length() > 1 ? ";" : "") << itRel->second->m_to_way_id;
+						nRelationsWritten++;
+					}
+				}
+			}
+		}
+	}
+
+	return str.str();
+}
+
+void ReadKeyValuePairsForWay(char*& s, map<string, ParameterValues*>& mapIncludedValues, map<string, ParameterValues*>& mapExcludedValues,
+							vector<string>& values_in_current_way, string& strMifTypeForThisWay, string& strStyleForThisWay,
+							bool& fBreakUpThisWay, bool& fSkipThisWay, bool& fFoundAtLeastOneIncludedValueInThisWay,
+							int& nNumberOfMandatoryKeysFoundForThisWay, double& dblSimplifyToleranceForThisWay)
+{
+	fBreakUpThisWay = true;
+
+	char* tag = strstr(s, "<tag k=\""), * tag_end = (tag != NULL ? strstr(tag + 8, "\"") : NULL);
+	if (tag != NULL && tag_end != NULL)
+	{
+		char* v = strstr(tag, "v=\""), * v_end = (v != NULL ? strstr(v + 3, "\"") : NULL);
+		if (v != NULL && v_end != NULL)
+		{
+			string strFind(tag + 8, tag_end);
+			string strValue(v + 3, v_end);
+
+			map<string, ParameterValues*>::iterator itKeyExclude = mapExcludedValues.find(strFind);
+			if (itKeyExclude != mapExcludedValues.end() 
+				&& 
+				(itKeyExclude->second->m_fIsAll || itKeyExclude->second->m_setValues.find(strValue) != itKeyExclude->second->m_setValues.end()))
+					fSkipThisWay = true;
+			else
+			{
+				map<string, ParameterValues*>::iterator itKey = mapIncludedValues.find(strFind);
+				if (itKey != mapIncludedValues.end())
+				{
+					if (!strValue.empty()
+						&&
+						(itKey->second->m_fIsAll || itKey->second->m_setValues.find(strValue) != itKey->second->m_setValues.end()))
+					{
+						fFoundAtLeastOneIncludedValueInThisWay = true;
+						if (itKey->second->m_fIsMandatory)
+							nNumberOfMandatoryKeysFoundForThisWay++;
+
+						string strTransformedValue = strValue;
+						if (itKey->second->m_mapTransform.find(strValue) != itKey->second->m_mapTransform.end())
+							strTransformedValue = itKey->second->m_mapTransform.find(strValue)->second;
+						values_in_current_way[itKey->second->m_nColumn] = strTransformedValue;
+
+						if (itKey->second->m_mapDrawStyle.find(strValue) != itKey->second->m_mapDrawStyle.end())
+							strStyleForThisWay = itKey->second->m_mapDrawStyle.find(strValue)->second;
+
+						if (itKey->second->m_mapMifType.find(strValue) != itKey->second->m_mapMifType.end())
+							strMifTypeForThisWay = itKey->second->m_mapMifType.find(strValue)->second;
+
+						if (itKey->second->m_mapBreakUp.find("no") != itKey->second->m_mapBreakUp.end())
+							fBreakUpThisWay = false;
+
+						// a tolerance given for this value overrides one given for the wildcard
+						if (itKey->second->m_mapSimplifyTolerance.find(strValue) != itKey->second->m_mapSimplifyTolerance.end())
+							dblSimplifyToleranceForThisWay = itKey->second->m_mapSimplifyTolerance.find(strValue)->second;
+						else if (itKey->second->m_mapSimplifyTolerance.find("*") != itKey->second->m_mapSimplifyTolerance.end())
+							dblSimplifyToleranceForThisWay = itKey->second->m_mapSimplifyTolerance.find("*")->second;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Whether a node is inside the bounding box of the parameters file (every node is if it has none)
+bool IsInBoundingBox(double latitude, double longitude, double min_lon, double min_lat, double max_lon, double max_lat)
+{
+	return (min_lon == LONG_MAX && min_lat == LONG_MAX && max_lon == LONG_MAX && max_lat == LONG_MAX)
+		   ||
+		   (longitude >= min_lon && longitude <= max_lon && latitude >= min_lat && latitude <= max_lat);
+}
+
+// Read the id, latitude and longitude of a node line.  fIsNode is false if the line doesn't have all three; returns false (with
+// strError set) if one of them isn't a number.
+bool ReadNode(char* s, bool& fIsNode, long& node_id, double& latitude, double& longitude, string& strError)
+{
+	char* id, * id_end, * lat, * lon, * lat_end, * lon_end;
+	id = strstr(s, "<node id=\"");
+	id_end = (id != NULL ? strstr(id+strlen("<node id=\"")+1, "\"") : NULL);
+	lat = strstr(s, "lat=\"");
+	lon = strstr(s, "lon=\"");
+	lat_end = (lat != NULL ? strstr(lat+5, "\"") : NULL);
+	lon_end = (lon != NULL ? strstr(lon+5, "\"") : NULL);
+
+	fIsNode = (id != NULL && id_end != NULL && lat != NULL && lon != NULL && lat_end != NULL && lon_end != NULL);
+	if (!fIsNode)
+		return true;
+
+	if (!ConvertTextTolong(id+strlen("<node id=\""), node_id))
+	{
+		strError = "Could not turn " + string(id+strlen("<node id=\""), id_end) + " into a numeric ID";
+		return false;
+	}
+	if (!ConvertTextToDouble(lat+5, latitude))
+	{
+		strError = "Could not turn " + string(lat+5, lat_end) + " into a latitude";
+		return false;
+	}
+	if (!ConvertTextToDouble(lon+5, longitude))
+	{
+		strError = "Could not turn " + string(lon+5, lon_end) + " into a longitude";
+		return false;
+	}
+	return true;
+}
+
+// Read the id in quotes after szAttribute (e.g. "<way id=\"") on this line, leaving id alone if the line doesn't have one.  Returns
+// false (with strError set) if it isn't a number; strWhat names it in the error.
+bool ReadId(char* s, const char* szAttribute, const string& strWhat, long& id, string& strError)
+{
+	char* start = strstr(s, szAttribute), * end = (start != NULL ? strstr(start + strlen(szAttribute), "\"") : NULL);
+	if (start == NULL || end == NULL)
+		return true;
+	if (!ConvertTextTolong(start + strlen(szAttribute), id))
+	{
+		strError = "Could not turn " + strWhat + " " + string(start + strlen(szAttribute), end) + " into a numeric ID";
+		return false;
+	}
+	return true;
+}
+
+// Read a member or the type tag of a relation into it: the from/via/to members of a restriction, the outer and inner ways of a
+// multipolygon.  Returns false (with strError set) if a member id isn't a number.
+bool ReadRelationMemberOrType(char* s, Relation* relation, string& strError)
+{
+	bool fIsNode = false, fIsWay = false;
+	if (strstr(s, "<member type=\"node") != NULL)
+		fIsNode = true;
+	if (strstr(s, "<member type=\"way") != NULL)
+		fIsWay = true;
+
+	if (fIsNode || fIsWay)
+	{
+		long id_of_member_type = -1;
+		if (!ReadId(s, "ref=\"", "relation member ID", id_of_member_type, strError))
+			return false;
+		bool fIsFromWay = false, fIsOuterWay = false, fIsInnerWay = false;
+		if (fIsNode && strstr(s, "role=\"via") != NULL)
+			;
+		else if (fIsWay && strstr(s, "role=\"from") != NULL)
+			fIsFromWay = true;
+		else if (fIsWay && strstr(s, "role=\"to") != NULL)
+			fIsFromWay = false;
+		else if (fIsWay && strstr(s, "role=\"inner") != NULL)
+			fIsInnerWay = true;
+		else if (fIsWay && (strstr(s, "role=\"outer") != NULL || strstr(s, "role=\"\"") != NULL))
+			fIsOuterWay = true;
+		else
+			relation->m_fIsRestriction = false; // not a restriction
+
+		if (fIsNode)
+			relation->m_node_via_id = id_of_member_type;
+		else if (fIsOuterWay)
+			relation->m_outer_way_ids.push_back(id_of_member_type);
+		else if (fIsInnerWay)
+			relation->m_inner_way_ids.push_back(id_of_member_type);
+		else if (fIsFromWay)
+			relation->m_from_way_ids.push_back(id_of_member_type);
+		else
+			relation->m_to_way_id = id_of_member_type;
+	}
+
+	if (strstr(s, "<tag k=\"type") != NULL)
+	{
+		char* v = strstr(s, "v=\""), * v_end = (v != NULL ? strstr(v+3, "\"") : NULL);
+		if (v != NULL && v_end != NULL && string(v+3, v_end) == "restriction")
+			relation->m_fIsRestriction = true;
+		if (v != NULL && v_end != NULL && (string(v+3, v_end) == "multipolygon" || string(v+3, v_end) == "boundary"))
+			relation->m_fIsMultipolygon = true;
+	}
+	return true;
+}
+
+// Whether a relation, once read, is a multipolygon to write as a region, or a turn restriction to look for on its from ways
+bool IsMultipolygonToWrite(const Relation* relation)
+{
+	return relation->m_fIsMultipolygon && !relation->m_fSkip && relation->m_fFoundAtLeastOneIncludedValue 
+		   && relation->m_nNumberOfMandatoryKeysFound >= 1 && relation->m_outer_way_ids.size() > 0;
+}
+bool IsRestrictionToProcess(const Relation* relation)
+{
+	return !relation->m_fIsMultipolygon && relation->m_from_way_ids.size() > 0 && relation->m_to_way_id >= 0 && relation->m_node_via_id >= 0;
+}
+
+// Stitch member ways into closed rings of node ids.  Open ways are indexed by both end node ids in a hash map, so each
+// ring is grown by looking up the way that continues from its current end rather than by searching all the other ways.
+void StitchRings(vector<long>& way_ids, map<long, vector<long> >& nodes_in_each_way, vector<vector<long> >& rings, int& nOpenRings)
+{
+	vector<vector<long>*> open_ways;
+	unordered_multimap<long, int> way_ends;
+
+	for (vector<long>::iterator itWay = way_ids.begin(); itWay != way_ids.end(); itWay++)
+	{
+		map<long, vector<long> >::iterator itNodes = nodes_in_each_way.find(*itWay);
+		if (itNodes == nodes_in_each_way.end() || itNodes->second.size() < 2)
+			continue;
+
+		vector<long>& nodes = itNodes->second;
+		if (nodes.front() == nodes.back())
+			rings.push_back(nodes);
+		else
+		{
+			way_ends.insert(pair<long, int>(nodes.front(), (int)open_ways.size()));
+			way_ends.insert(pair<long, int>(nodes.back(), (int)open_ways.size()));
+			open_ways.push_back(&nodes);
+		}
+	}
+
+	vector<bool> used(open_ways.size(), false);
+	for (int i = 0; i < (int)open_ways.size(); i++)
+	{
+		if (used[i])
+			continue;
+		used[i] = true;
+		vector<long> ring = *open_ways[i];
+
+		while (ring.front() != ring.back())
+		{
+			int next = -1;
+			pair<unordered_multimap<long, int>::iterator, unordered_multimap<long, int>::iterator> itEnds = way_ends.equal_range(ring.back());
+			for (unordered_multimap<long, int>::iterator itEnd = itEnds.first; itEnd != itEnds.second; itEnd++)
+				if (!used[itEnd->second])
+				{
+					next = itEnd->second;
+					break;
+				}
+			if (next < 0)
+				break;
+
+			used[next] = true;
+			vector<long>& nodes = *open_ways[next];
+			if (nodes.front() == ring.back())
+				ring.insert(ring.end(), nodes.begin() + 1, nodes.end());
+			else
+				ring.insert(ring.end(), nodes.rbegin() + 1, nodes.rend());
+		}
+
+		if (ring.front() == ring.back())
+			rings.push_back(ring);
+		else
+			nOpenRings++;
+	}
+}
+
+// Even-odd test of whether a point lies inside a ring
+bool IsPointInRing(double x, double y, vector<pair<double,double> >& ring)
+{
+	bool fInside = false;
+	for (int i = 0, j = (int)ring.size() - 1; i < (int)ring.size(); j = i++)
+	{
+		double xi = ring[i].second, yi = ring[i].first, xj = ring[j].second, yj = ring[j].first;
+		if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+			fInside = !fInside;
+	}
+	return fInside;
+}
+
+// Uniform grid over the bounding boxes of a relation's outer rings, so each inner ring is only tested against the outers
+// whose boxes overlap the grid cell of the point it is tested at.
+class OuterRingIndex
+{
+public:
+	OuterRingIndex(vector<vector<pair<double,double> > >& outers) : m_outers(outers)
+	{
+		m_min_x = m_min_y = 1e30;
+		m_max_x = m_max_y = -1e30;
+		for (vector<vector<pair<double,double> > >::iterator itRing = outers.begin(); itRing != outers.end(); itRing++)
+		{
+			double min_x = 1e30, min_y = 1e30, max_x = -1e30, max_y = -1e30;
+			ExtendBounds(*itRing, min_x, min_y, max_x, max_y);
+			m_bounds.push_back(make_pair(make_pair(min_x, min_y), make_pair(max_x, max_y)));
+			m_min_x = min(m_min_x, min_x);
+			m_max_x = max(m_max_x, max_x);
+			m_min_y = min(m_min_y, min_y);
+			m_max_y = max(m_max_y, max_y);
+			m_outer_vertices.insert(m_outer_vertices.end(), itRing->begin(), itRing->end());
+		}
+		sort(m_outer_vertices.begin(), m_outer_vertices.end());
+
+		m_nCells = max(1, min(64, (int)sqrt((double)outers.size())));
+		m_cells.resize(m_nCells * m_nCells);
+		for (int i = 0; i < (int)m_bounds.size(); i++)
+			for (int cx = Cell(m_bounds[i].first.first, m_min_x, m_max_x); cx <= Cell(m_bounds[i].second.first, m_min_x, m_max_x); cx++)
+				for (int cy = Cell(m_bounds[i].first.second, m_min_y, m_max_y); cy <= Cell(m_bounds[i].second.second, m_min_y, m_max_y); cy++)
+					m_cells[cy * m_nCells + cx].push_back(i);
+	}
+
+	// Returns the smallest outer ring containing the inner ring, or -1 if there is none
+	int FindOuter(vector<pair<double,double> >& inner)
+	{
+		pair<double,double> point = TestPoint(inner);
+		double x = point.second, y = point.first;
+		if (x < m_min_x || x > m_max_x || y < m_min_y || y > m_max_y)
+			return -1;
+
+		int nFound = -1;
+		double dblFoundArea = 0;
+		vector<int>& candidates = m_cells[Cell(y, m_min_y, m_max_y) * m_nCells + Cell(x, m_min_x, m_max_x)];
+		for (vector<int>::iterator it = candidates.begin(); it != candidates.end(); it++)
+		{
+			pair<pair<double,double>, pair<double,double> >& bounds = m_bounds[*it];
+			if (x < bounds.first.first || x > bounds.second.first || y < bounds.first.second || y > bounds.second.second)
+				continue;
+			double dblArea = (bounds.second.first - bounds.first.first) * (bounds.second.second - bounds.first.second);
+			if ((nFound < 0 || dblArea < dblFoundArea) && IsPointInRing(x, y, m_outers[*it]))
+			{
+				nFound = *it;
+				dblFoundArea = dblArea;
+			}
+		}
+		return nFound;
+	}
+
+private:
+	int Cell(double v, double min_v, double max_v)
+	{
+		if (max_v <= min_v)
+			return 0;
+		return min(m_nCells - 1, (int)((v - min_v) / (max_v - min_v) * m_nCells));
+	}
+
+	// The point to test an inner ring at: its first vertex that is not also a vertex of an outer ring, since an inner ring often
+	// touches its outer at a shared node, where the even-odd test could go either way.  If every vertex is shared, its centroid.
+	pair<double,double> TestPoint(vector<pair<double,double> >& inner)
+	{
+		for (vector<pair<double,double> >::iterator it = inner.begin(); it != inner.end(); it++)
+			if (!binary_search(m_outer_vertices.begin(), m_outer_vertices.end(), *it))
+				return *it;
+
+		double dblArea = 0, lat = 0, lon = 0;
+		for (int i = 0, j = (int)inner.size() - 1; i < (int)inner.size(); j = i++)
+		{
+			double dblCross = inner[j].second * inner[i].first - inner[i].second * inner[j].first;
+			dblArea += dblCross;
+			lon += (inner[j].second + inner[i].second) * dblCross;
+			lat += (inner[j].first + inner[i].first) * dblCross;
+		}
+		if (fabs(dblArea) > 0)
+			return make_pair(lat / (3 * dblArea), lon / (3 * dblArea));
+
+		// no area: the mean of the vertices
+		lat = lon = 0;
+		for (vector<pair<double,double> >::iterator it = inner.begin(); it != inner.end(); it++)
+		{
+			lat += it->first;
+			lon += it->second;
+		}
+		return make_pair(lat / inner.size(), lon / inner.size());
+	}
+
+	vector<vector<pair<double,double> > >& m_outers;
+	vector<pair<double,double> > m_outer_vertices;						// (lat, lon) of every outer ring's vertices, sorted
+	vector<pair<pair<double,double>, pair<double,double> > > m_bounds;	// (min lon, min lat), (max lon, max lat) of each outer
+	vector<vector<int> > m_cells;
+	int m_nCells;
+	double m_min_x, m_min_y, m_max_x, m_max_y;
+};
+
+// Turn rings of node ids into rings of lat/longs, dropping nodes outside the bounding box and any ring left with less than a triangle
+void RingsToLatLons(vector<vector<long> >& rings, NodeStore& nodes, map<long, int>& way_counts,
+					double dblSimplifyTolerance, vector<vector<pair<double,double> > >& latlon_rings, long& nodes_simplified_away)
+{
+	for (vector<vector<long> >::iterator itRing = rings.begin(); itRing != rings.end(); itRing++)
+	{
+		vector<pair<double,double> > latlons;
+		vector<bool> intersections;
+		pair<double,double> latlon;
+		for (vector<long>::iterator it = itRing->begin(); it != itRing->end(); it++)
+		{
+			if (nodes.Find(*it, latlon))
+			{
+				latlons.push_back(latlon);
+				intersections.push_back(way_counts[*it] > 1);
+			}
+		}
+		if (latlons.size() > 0 && latlons.front() != latlons.back())
+		{
+			latlons.push_back(latlons.front());
+			intersections.push_back(intersections.front());
+		}
+		if (latlons.size() < 4)
+			continue;
+
+		if (dblSimplifyTolerance > 0)
+			nodes_simplified_away += SimplifyLatLons(latlons, intersections, dblSimplifyTolerance, true);
+		latlon_rings.push_back(latlons);
+	}
+}
+
+// Assemble each multipolygon/boundary relation into its outer and inner rings and pass it to the sink as one multi-ring region, with
+// each outer ring followed by the inner rings it contains.  Inner rings that lie in no outer ring are dropped.
+bool WriteMultipolygonRelations(OSM2MIFSink& sink, vector<Relation*>& multipolygons, map<long, vector<long> >& nodes_in_each_way,
+								NodeStore& nodes, map<long, int>& way_counts, bool fWriteRelations,
+								int& nMultipolygonsWritten, int& nOpenRings, int& nOrphanInnerRings, long& nodes_written, long& nodes_simplified_away,
+								string& strError)
+{
+	string strNoRestrictions;
+	for (vector<Relation*>::iterator itRelation = multipolygons.begin(); itRelation != multipolygons.end(); itRelation++)
+	{
+		Relation* relation = *itRelation;
+
+		vector<vector<long> > outer_node_rings, inner_node_rings;
+		StitchRings(relation->m_outer_way_ids, nodes_in_each_way, outer_node_rings, nOpenRings);
+		StitchRings(relation->m_inner_way_ids, nodes_in_each_way, inner_node_rings, nOpenRings);
+
+		vector<vector<pair<double,double> > > outers, inners;
+		RingsToLatLons(outer_node_rings, nodes, way_counts, relation->m_dblSimplifyTolerance, outers, nodes_simplified_away);
+		RingsToLatLons(inner_node_rings, nodes, way_counts, relation->m_dblSimplifyTolerance, inners, nodes_simplified_away);
+		if (outers.empty())
+			continue;
+
+		vector<vector<int> > inners_of_outer(outers.size());
+		OuterRingIndex index(outers);
+		for (int i = 0; i < (int)inners.size(); i++)
+		{
+			int nOuter = index.FindOuter(inners[i]);
+			if (nOuter >= 0)
+				inners_of_outer[nOuter].push_back(i);
+			else
+				nOrphanInnerRings++;
+		}
+
+		vector<vector<pair<double,double> > > rings;
+		for (int i = 0; i < (int)outers.size(); i++)
+		{
+			rings.push_back(outers[i]);
+			for (vector<int>::iterator it = inners_of_outer[i].begin(); it != inners_of_outer[i].end(); it++)
+				rings.push_back(inners[*it]);
+		}
+		for (vector<vector<pair<double,double> > >::iterator itRing = rings.begin(); itRing != rings.end(); itRing++)
+			nodes_written += itRing->size();
+
+		OSM2MIFRecord record;
+		record.m_fIsRegion = true;
+		record.m_pStyle = &relation->m_strStyle;
+		record.m_rings = OSM2MIFSpan<vector<pair<double,double> > >(rings);
+		record.m_values = OSM2MIFSpan<string>(relation->m_values);
+		record.m_pRestrictions = (fWriteRelations ? &strNoRestrictions : NULL);
+		if (!sink.Record(record, strError))
+			return false;
+		nMultipolygonsWritten++;
+	}
+	return true;
+}
+
+
+// Peak resident set size of this process so far, in kilobytes
+long GetPeakRSSKilobytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;	// bytes on macOS
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// User plus system CPU time used by this process so far, in seconds
+double GetProcessCPUSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exited, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER kernel100ns, user100ns;
+	kernel100ns.LowPart = kernel.dwLowDateTime;
+	kernel100ns.HighPart = kernel.dwHighDateTime;
+	user100ns.LowPart = user.dwLowDateTime;
+	user100ns.HighPart = user.dwHighDateTime;
+	return (kernel100ns.QuadPart + user100ns.QuadPart) / 1e7;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+double GetWallSeconds()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+RunStatistics::RunStatistics()
+{
+	m_nCurrentPhase = -1;
+}
+
+void RunStatistics::StartPhase(const string& strName)
+{
+	EndPhase();
+	PhaseTimes phase;
+	phase.m_strName = strName;
+	phase.m_dblWallStart = GetWallSeconds();
+	phase.m_dblCPUStart = GetProcessCPUSeconds();
+	phase.m_dblWallSeconds = phase.m_dblCPUSeconds = 0;
+	m_phases.push_back(phase);
+	m_nCurrentPhase = (int)m_phases.size() - 1;
+}
+
+void RunStatistics::EndPhase()
+{
+	if (m_nCurrentPhase < 0)
+		return;
+	PhaseTimes& phase = m_phases[m_nCurrentPhase];
+	phase.m_dblWallSeconds = GetWallSeconds() - phase.m_dblWallStart;
+	phase.m_dblCPUSeconds = GetProcessCPUSeconds() - phase.m_dblCPUStart;
+	m_nCurrentPhase = -1;
+}
+
+double RunStatistics::PhaseWallSeconds(const string& strName)
+{
+	for (vector<PhaseTimes>::iterator it = m_phases.begin(); it != m_phases.end(); it++)
+		if (it->m_strName == strName)
+			return it->m_dblWallSeconds;
+	return 0;
+}
+
+double RunStatistics::TotalWallSeconds()
+{
+	double dblTotal = 0;
+	for (vector<PhaseTimes>::iterator it = m_phases.begin(); it != m_phases.end(); it++)
+		dblTotal += it->m_dblWallSeconds;
+	return dblTotal;
+}
+
+void RunStatistics::Prepend(const RunStatistics& earlier)
+{
+	if (m_nCurrentPhase >= 0)
+		m_nCurrentPhase += (int)earlier.m_phases.size();
+	m_phases.insert(m_phases.begin(), earlier.m_phases.begin(), earlier.m_phases.end());
+	m_values.insert(m_values.begin(), earlier.m_values.begin(), earlier.m_values.end());
+}
+
+void RunStatistics::Set(const string& strSection, const string& strName, double dblValue)
+{
+	StatValue value;
+	value.m_strSection = strSection;
+	value.m_strName = strName;
+	value.m_dblValue = dblValue;
+	m_values.push_back(value);
+}
+
+void RunStatistics::PrintPhases()
+{
+	for (vector<PhaseTimes>::iterator it = m_phases.begin(); it != m_phases.end(); it++)
+		printf("%-16s %9.3f s wall %9.3f s CPU\n", it->m_strName.c_str(), it->m_dblWallSeconds, it->m_dblCPUSeconds);
+}
+
+bool RunStatistics::WriteJson(const string& strFile, string& strError)
+{
+	FILE* out = fopen(strFile.c_str(), "w");
+	if (out == NULL)
+	{
+		strError = "Could not open " + strFile + " for writing";
+		return false;
+	}
+
+	fprintf(out, "{\n  \"phases\": [\n");
+	for (int i = 0; i < (int)m_phases.size(); i++)
+		fprintf(out, "    {\"name\": \"%s\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f}%s\n", m_phases[i].m_strName.c_str(),
+				m_phases[i].m_dblWallSeconds, m_phases[i].m_dblCPUSeconds, i + 1 < (int)m_phases.size() ? "," : "");
+	fprintf(out, "  ]");
+
+	// the values, grouped by section in the order the sections were first used
+	vector<string> sections;
+	for (vector<StatValue>::iterator it = m_values.begin(); it != m_values.end(); it++)
+		if (find(sections.begin(), sections.end(), it->m_strSection) == sections.end())
+			sections.push_back(it->m_strSection);
+	for (vector<string>::iterator itSection = sections.begin(); itSection != sections.end(); itSection++)
+	{
+		fprintf(out, ",\n  \"%s\": {", itSection->c_str());
+		bool fFirst = true;
+		for (vector<StatValue>::iterator it = m_values.begin(); it != m_values.end(); it++)
+			if (it->m_strSection == *itSection)
+			{
+				fprintf(out, "%s\n    \"%s\": %.15g", fFirst ? "" : ",", it->m_strName.c_str(), it->m_dblValue);
+				fFirst = false;
+			}
+		fprintf(out, "\n  }");
+	}
+	fprintf(out, "\n}\n");
+
+	bool fOK = (ferror(out) == 0);
+	fclose(out);
+	if (!fOK)
+		strError = "Could not write to " + strFile;
+	return fOK;
+}
+
+// Progress through the two passes over the osm file, measured by the bytes read rather than element counts (which can't be known
+// up front).  Update() is called for every line but only looks at the clock every few thousand lines, and prints at most once a second.
+class ProgressReporter
+{
+public:
+	ProgressReporter(long long nInputBytes, bool fEnabled)
+	{
+		m_nInputBytes = max(1LL, nInputBytes);
+		m_fEnabled = fEnabled;
+		m_nCalls = 0;
+		m_dblStart = m_dblLastPrinted = GetWallSeconds();
+	}
+
+	void Update(int nPass, long long nBytesReadThisPass, const char* szElement1, long nCount1, const char* szElement2, long nCount2)
+	{
+		if (!m_fEnabled || (++m_nCalls & 0x3FFF) != 0)
+			return;
+		double dblNow = GetWallSeconds();
+		if (dblNow - m_dblLastPrinted < 1.0)
+			return;
+		m_dblLastPrinted = dblNow;
+
+		// both passes read the whole file, so each is counted as half the work
+		double dblDone = ((nPass - 1) * (double)m_nInputBytes + nBytesReadThisPass) / (2.0 * m_nInputBytes);
+		double dblElapsed = dblNow - m_dblStart;
+		int nETA = (dblDone > 0 ? (int)(dblElapsed * (1 - dblDone) / dblDone) : 0);
+		printf("---- Pass %d: %5.1f%% [%s %ld, %s %ld] ETA %d:%02d:%02d\n", nPass, 100 * dblDone, szElement1, nCount1, szElement2, nCount2,
+			   nETA / 3600, (nETA / 60) % 60, nETA % 60);
+	}
+
+private:
+	long long m_nInputBytes;
+	bool m_fEnabled;
+	unsigned long m_nCalls;
+	double m_dblStart, m_dblLastPrinted;
+};
+
+// Owns the relations kept from pass 1.  A restriction is indexed once for each of its 'from' ways, so the set makes sure each is
+// deleted only once.
+class RelationStore
+{
+public:
+	RelationStore() : m_pCurrent(NULL) {}
+	~RelationStore()
+	{
+		set<Relation*> restrictions;
+		for (multimap<long, Relation*>::iterator it = m_restrictions.begin(); it != m_restrictions.end(); it++)
+			restrictions.insert(it->second);
+		for (set<Relation*>::iterator it = restrictions.begin(); it != restrictions.end(); it++)
+			delete *it;
+		for (vector<Relation*>::iterator it = m_multipolygons.begin(); it != m_multipolygons.end(); it++)
+			delete *it;
+		delete m_pCurrent;
+	}
+	multimap<long, Relation*> m_restrictions;
+	vector<Relation*> m_multipolygons;
+	Relation* m_pCurrent;	// the relation being read, until it is kept or deleted
+};
+
+
+OSMFileSource::OSMFileSource(const string& strFile) : m_strFile(strFile), m_buffer(LINE_BUFFER_LENGTH), m_nSize(0)
+{
+}
+
+bool OSMFileSource::Open(string& strError)
+{
+	if (m_in.is_open())
+		m_in.close();
+	m_in.clear();
+	m_in.open(m_strFile.c_str());
+	if (!m_in.good())
+	{
+		strError = "Could not open " + m_strFile + " for reading";
+		return false;
+	}
+	ifstream size_in(m_strFile.c_str(), ios::binary | ios::ate);
+	m_nSize = size_in.tellg();
+	return true;
+}
+
+bool OSMFileSource::GetLine(char*& szLine)
+{
+	return GetLineFromFile(m_in, &m_buffer[0], szLine);
+}
+
+
+OSMMemorySource::OSMMemorySource(const char* pData, size_t nLength)
+	: m_pData(pData), m_nLength(nLength), m_nPosition(0), m_nLastLineBytes(0), m_buffer(LINE_BUFFER_LENGTH)
+{
+}
+
+bool OSMMemorySource::Open(string& /*strError*/)
+{
+	m_nPosition = 0;
+	m_nLastLineBytes = 0;
+	return true;
+}
+
+bool OSMMemorySource::GetLine(char*& szLine)
+{
+	m_nLastLineBytes = 0;
+	if (m_nPosition >= m_nLength)
+		return false;
+
+	const char* pStart = m_pData + m_nPosition;
+	const char* pEnd = (const char*)memchr(pStart, '\n', m_nLength - m_nPosition);
+	size_t nLength = (pEnd != NULL ? pEnd - pStart : m_nLength - m_nPosition);
+	m_nLastLineBytes = nLength + (pEnd != NULL ? 1 : 0);
+	m_nPosition += (size_t)m_nLastLineBytes;
+
+	if (nLength > 0 && pStart[nLength - 1] == '\r')
+		nLength--;
+	// as for files, an empty line or one too long for the line buffer ends the input
+	if (nLength == 0 || nLength >= m_buffer.size())
+		return false;
+
+	memcpy(&m_buffer[0], pStart, nLength);
+	m_buffer[nLength] = '\0';
+	szLine = &m_buffer[0];
+	return true;
+}
+
+
+OSM2MIFConfig::OSM2MIFConfig()
+{
+	m_min_lon = m_min_lat = m_max_lon = m_max_lat = LONG_MAX;
+	m_fProcessRelations = true;
+	m_fProgress = false;
+	m_fDetailedStatistics = false;
+	m_fCompressNodes = false;
+	m_pShardPlan = NULL;
+	m_nShard = 0;
+}
+
+OSM2MIFConfig::~OSM2MIFConfig()
+{
+	for (map<string, ParameterValues*>::iterator it = m_mapIncludedValues.begin(); it != m_mapIncludedValues.end(); it++)
+		delete it->second;
+	for (map<string, ParameterValues*>::iterator it = m_mapExcludedValues.begin(); it != m_mapExcludedValues.end(); it++)
+		delete it->second;
+}
+
+bool OSM2MIFConfig::ReadParametersFile(const string& strParametersFile, string& strError)
+{
+	strError = "";
+	if (::ReadParametersFile(strParametersFile, m_min_lon, m_min_lat, m_max_lon, m_max_lat, m_mapIncludedValues, m_mapExcludedValues, strError))
+		return true;
+	if (strError.empty())
+		strError = "Could not open " + strParametersFile + " for reading";
+	return false;
+}
+
+
+// Whether a way is a member of a multipolygon with the same values, apart from the id.  This is how old-style multipolygons are
+// tagged (on the outer way as well as the relation), and such a way is only written as part of the multipolygon's region.
+bool HasValuesOfItsMultipolygon(long way_id, const vector<string>& values, int nIdColumn, multimap<long, Relation*>& multipolygon_members)
+{
+	pair<multimap<long, Relation*>::iterator, multimap<long, Relation*>::iterator> itMembers = multipolygon_members.equal_range(way_id);
+	for (multimap<long, Relation*>::iterator itMember = itMembers.first; itMember != itMembers.second; itMember++)
+	{
+		const vector<string>& relation_values = itMember->second->m_values;
+		bool fSame = (relation_values.size() == values.size());
+		for (int i = 0; fSame && i < (int)values.size(); i++)
+			fSame = (i == nIdColumn || values[i] == relation_values[i]);
+		if (fSame)
+			return true;
+	}
+	return false;
+}
+
+// The shard of a way (or a multipolygon's outer way) when converting one shard: the strip of its first node inside the bounding box.
+// -1 if it has no node in the bounding box, -2 if its first one is outside this shard's halo (so it belongs to another shard).
+int FirstNodeShard(const vector<long>& node_ids, NodeStore& nodes, const vector<long>& nodes_in_other_shards, const OSM2MIFShardPlan& plan)
+{
+	pair<double,double> latlon;
+	for (vector<long>::const_iterator it = node_ids.begin(); it != node_ids.end(); it++)
+	{
+		if (nodes.Find(*it, latlon))
+			return plan.ShardOfLongitude(latlon.second);
+		if (binary_search(nodes_in_other_shards.begin(), nodes_in_other_shards.end(), *it))
+			return -2;
+	}
+	return -1;
+}
+
+// The same for a way by id.  The ways a shard did not keep, because they are only in other shards, are in ways_in_other_shards.
+int WayShard(long way_id, map<long, vector<long> >& nodes_in_each_way, const vector<long>& ways_in_other_shards, NodeStore& nodes,
+			 const vector<long>& nodes_in_other_shards, const OSM2MIFShardPlan& plan)
+{
+	if (binary_search(ways_in_other_shards.begin(), ways_in_other_shards.end(), way_id))
+		return -2;
+	map<long, vector<long> >::iterator itNodes = nodes_in_each_way.find(way_id);
+	return (itNodes != nodes_in_each_way.end() ? FirstNodeShard(itNodes->second, nodes, nodes_in_other_shards, plan) : -1);
+}
+
+bool OSM2MIFConverter::Convert(OSMInputSource& source, OSM2MIFSink& sink, string& strError)
+{
+	m_counts = OSM2MIFRunCounts();
+	m_stats = RunStatistics();
+
+	map<string, ParameterValues*>& mapIncludedValues = m_config.m_mapIncludedValues;
+	map<string, ParameterValues*>& mapExcludedValues = m_config.m_mapExcludedValues;
+	double min_lon = m_config.m_min_lon, min_lat = m_config.m_min_lat, max_lon = m_config.m_max_lon, max_lat = m_config.m_max_lat;
+	bool fProcessRelations = m_config.m_fProcessRelations;
+
+	int& node_count = m_counts.m_nNodes;
+	int& nodes_skipped = m_counts.m_nNodesSkipped;
+	int& way_count = m_counts.m_nWays;
+	int& ways_skipped = m_counts.m_nWaysSkipped;
+	int& ways_written = m_counts.m_nWaysWritten;
+
+	// the output columns are the included keys, in key order.  They are numbered here rather than relying on ReadParametersFile,
+	// since the config may have been built in code.
+	vector<OSM2MIFColumn> columns;
+	int nIdColumn = -1;
+	for (map<string, ParameterValues*>::iterator itKey = mapIncludedValues.begin(); itKey != mapIncludedValues.end(); itKey++)
+	{
+		itKey->second->m_nColumn = (int)columns.size();
+		OSM2MIFColumn column;
+		column.m_strName = itKey->first;
+		map<string, string>::iterator itType = itKey->second->m_mapTypes.find(itKey->first);
+		column.m_strType = (itType != itKey->second->m_mapTypes.end() ? itType->second : "Char(250)");
+		if (itKey->first == "id")
+			nIdColumn = (int)columns.size();
+		columns.push_back(column);
+	}
+
+	if (!source.Open(strError))
+		return false;
+	long long input_bytes = source.Size();
+	ProgressReporter progress(input_bytes, m_config.m_fProgress);
+
+	if (!sink.Begin(columns, fProcessRelations, strError))
+		return false;
+
+	NodeStore nodes(m_config.m_fCompressNodes);
+	map<long, int> way_counts;
+	map<long, vector<long> > nodes_in_each_way;
+	vector<long> nodes_in_other_shards;		// nodes in the bounding box but outside this shard's halo, in id order
+	bool fNodesInOtherShardsSorted = true;
+	vector<long> ways_in_other_shards;		// ways with nodes in the bounding box, none of them in this shard's halo, in id order
+	bool fWaysInOtherShardsSorted = true;
+	vector<long> nodes_in_current_way;
+	bool fCurrentWayInHalo = false;
+	const OSM2MIFShardPlan* pShardPlan = m_config.m_pShardPlan;
+	RelationStore relation_store;
+	multimap<long, Relation*>& relations = relation_store.m_restrictions;
+	vector<Relation*>& multipolygons = relation_store.m_multipolygons;
+	multimap<long, Relation*> multipolygon_members;		// the multipolygons each way is an outer or inner member of
+	Relation*& current_relation = relation_store.m_pCurrent;
+
+	string strDefaultStyle = "Pen (2,54,32768)";
+	string strDefaultMifType = "Pline";
+
+	int line, pass_1_lines;
+	long long bytes_read_in_pass = 0, bytes_read = 0;
+	long id_of_current_way = LONG_MAX;
+	bool fReadingWays = false, fReadingRelations = false;
+	char szNumber[32];
+
+	// We read in the OSM file twice:
+	//     The first time, we store the lat/long data for each node (in the bounding box); the nodes in each way; the 
+	//       number of times a node appears in the ways ("way_counts").  We also store any restriction and multipolygon relations found.
+	//       When converting one shard, only the nodes in its halo are counted and the ways that are only in other shards are not kept.
+	//     The second time we read the file, we only read the ways, and we output them to the sink.  The multipolygons are then
+	//       assembled from the stored nodes in each way and appended as regions.
+
+	m_stats.StartPhase("node parse");
+	for (line = 0; line < INT_MAX; line++)
+	{
+		char* s;
+		if (!source.GetLine(s))
+		{
+			sprintf(szNumber, "%d", line);
+			strError = "The input ended without </osm> after " + string(szNumber) + " lines";
+			return false;
+		}
+		bytes_read_in_pass += source.LastLineBytes();
+		progress.Update(1, bytes_read_in_pass, "node", node_count, "in bounding box", nodes.Size());
+
+		if (strstr(s, "</osm>") != NULL)
+			break;
+
+		if (strstr(s, "<node id=") != NULL)
+		{
+			delete current_relation;
+			current_relation = NULL;
+
+			bool fIsNode;
+			long node_id;
+			double latitude, longitude;
+			if (!ReadNode(s, fIsNode, node_id, latitude, longitude, strError))
+				return false;
+			if (fIsNode)
+			{
+				if (IsInBoundingBox(latitude, longitude, min_lon, min_lat, max_lon, max_lat))
+				{
+					if (pShardPlan != NULL && (longitude < pShardPlan->m_shards[m_config.m_nShard].m_halo_west 
+											   || longitude > pShardPlan->m_shards[m_config.m_nShard].m_halo_east))
+					{
+						// only the id is kept, to tell which shard the ways through this node belong to
+						if (!nodes_in_other_shards.empty() && node_id < nodes_in_other_shards.back())
+							fNodesInOtherShardsSorted = false;
+						nodes_in_other_shards.push_back(node_id);
+						m_counts.m_nNodesInOtherShards++;
+					}
+					else
+					{
+						nodes.Add(node_id, latitude, longitude);
+						way_counts[node_id] = 0;
+					}
+				}
+				else
+					nodes_skipped++;
+
+				++node_count;
+			}
+		}
+
+		if (strstr(s, "<way id=") != NULL)
+		{
+			if (!fReadingWays)
+			{
+				fReadingWays = true;
+				m_stats.StartPhase("way parse");
+			}
+			id_of_current_way = LONG_MAX;
+			if (!ReadId(s, "<way id=\"", "way ID", id_of_current_way, strError))
+				return false;
+			nodes_in_current_way.clear();
+			fCurrentWayInHalo = false;
+		}
+
+		if (id_of_current_way != LONG_MAX)
+		{
+			long node_id = LONG_MAX;
+			if (!ReadId(s, "<nd ref=\"", "node ID", node_id, strError))
+				return false;
+			if (node_id != LONG_MAX)
+			{
+				// only the nodes in the bounding box (or the halo) have a count
+				map<long, int>::iterator itCount = way_counts.find(node_id);
+				if (itCount != way_counts.end())
+				{
+					itCount->second++;
+					fCurrentWayInHalo = true;
+				}
+
+				if (pShardPlan != NULL)
+					nodes_in_current_way.push_back(node_id);
+				else
+					nodes_in_each_way[id_of_current_way].push_back(node_id);
+			}
+			if (strstr(s, "</way>") != NULL)
+			{
+				// a shard keeps the ways with a node in its halo, which include every way it writes, the 'to' ways of their banned
+				// turns and the members of its multipolygons.  Of the ways with no node in the bounding box it only keeps the members
+				// of its multipolygons, which a single conversion stitches into their rings.
+				if (pShardPlan != NULL)
+				{
+					const vector<long>& outside_way_ids = pShardPlan->m_shards[m_config.m_nShard].m_outside_way_ids;
+					if (!fNodesInOtherShardsSorted)
+					{
+						sort(nodes_in_other_shards.begin(), nodes_in_other_shards.end());
+						fNodesInOtherShardsSorted = true;
+					}
+					bool fInOtherShard = false;
+					for (vector<long>::iterator it = nodes_in_current_way.begin(); !fCurrentWayInHalo && !fInOtherShard 
+						 && it != nodes_in_current_way.end(); it++)
+						fInOtherShard = binary_search(nodes_in_other_shards.begin(), nodes_in_other_shards.end(), *it);
+
+					if (!fCurrentWayInHalo && fInOtherShard)
+					{
+						if (!ways_in_other_shards.empty() && id_of_current_way < ways_in_other_shards.back())
+							fWaysInOtherShardsSorted = false;
+						ways_in_other_shards.push_back(id_of_current_way);
+					}
+					else if (!nodes_in_current_way.empty() && (fCurrentWayInHalo || binary_search(outside_way_ids.begin(), 
+															   outside_way_ids.end(), id_of_current_way)))
+					{
+						vector<long>& way_nodes = nodes_in_each_way[id_of_current_way];
+						way_nodes.insert(way_nodes.end(), nodes_in_current_way.begin(), nodes_in_current_way.end());
+					}
+				}
+				id_of_current_way = LONG_MAX;
+			}
+		}
+
+		if (strstr(s, "<relation id=") != NULL)
+		{
+			if (!fReadingRelations)
+			{
+				fReadingRelations = true;
+				m_stats.StartPhase("relation parse");
+			}
+			delete current_relation;
+			current_relation = new Relation;
+			current_relation->m_strStyle = strDefaultStyle;
+			current_relation->m_values.assign(columns.size(), "");
+			char* id = strstr(s, "<relation id=\""), * id_end = (id != NULL ? strstr(id + 14, "\"") : NULL);
+			if (id != NULL && id_end != NULL)
+				current_relation->m_strId = string(id + 14, id_end);
+			if (nIdColumn >= 0)
+				current_relation->m_values[nIdColumn] = current_relation->m_strId;
+		}
+
+		if (current_relation != NULL)
+		{
+			if (!ReadRelationMemberOrType(s, current_relation, strError))
+				return false;
+
+			// the relation's own tags decide whether a multipolygon is written, and with which values and style.  A multipolygon is
+			// always a region, so mif_type and break_up are ignored.
+			bool fBreakUpThisRelation;
+			string strMifTypeOfThisRelation;
+			ReadKeyValuePairsForWay(s, mapIncludedValues, mapExcludedValues, current_relation->m_values, strMifTypeOfThisRelation, 
+									current_relation->m_strStyle, fBreakUpThisRelation, current_relation->m_fSkip, 
+									current_relation->m_fFoundAtLeastOneIncludedValue, current_relation->m_nNumberOfMandatoryKeysFound,
+									current_relation->m_dblSimplifyTolerance);
+
+			if (strstr(s, "</relation>") != NULL && current_relation != NULL)
+			{
+				if (current_relation->m_fIsMultipolygon)
+				{
+					if (IsMultipolygonToWrite(current_relation))
+					{
+						multipolygons.push_back(current_relation);
+						for (vector<long>::iterator it = current_relation->m_outer_way_ids.begin(); it != current_relation->m_outer_way_ids.end(); it++)
+							multipolygon_members.insert(pair<long, Relation*>(*it, current_relation));
+						for (vector<long>::iterator it = current_relation->m_inner_way_ids.begin(); it != current_relation->m_inner_way_ids.end(); it++)
+							multipolygon_members.insert(pair<long, Relation*>(*it, current_relation));
+					}
+					else
+						delete current_relation;
+				}
+				else if (fProcessRelations && IsRestrictionToProcess(current_relation))
+				{
+					for (vector<long>::iterator it = current_relation->m_from_way_ids.begin(); it != current_relation->m_from_way_ids.end(); it++)
+						relations.insert(pair<long, Relation*>(*it, current_relation));
+				}
+				else
+					delete current_relation;
+				current_relation = NULL;
+			}
+		}
+	}
+
+	if (!fNodesInOtherShardsSorted)
+		sort(nodes_in_other_shards.begin(), nodes_in_other_shards.end());
+	if (!fWaysInOtherShardsSorted)
+		sort(ways_in_other_shards.begin(), ways_in_other_shards.end());
+
+	// go back to the start, ready to read the ways
+	pass_1_lines = line;
+	bytes_read = bytes_read_in_pass;
+	bytes_read_in_pass = 0;
+	if (!source.Open(strError))
+		return false;
+
+	id_of_current_way = LONG_MAX;
+	vector<string> values_in_current_way;
+	string strMifTypeForThisWay, strStyleForThisWay, strRestrictions;
+	bool fBreakUpThisWay = true, fSkipThisWay = false, fFoundAtLeastOneIncludedValueInThisWay = false;
+	int nNumberOfMandatoryKeysFoundForThisWay = 0;
+	int& nRestrictionsWrittenCount = m_counts.m_nRestrictionsWritten;
+	int& nRestrictionsInWaysCount = m_counts.m_nRestrictionsFound;
+	double dblSimplifyToleranceForThisWay = 0;
+	long& nodes_written = m_counts.m_nNodesWritten;
+	long& nodes_simplified_away = m_counts.m_nNodesSimplifiedAway;
+
+	m_stats.StartPhase("emission");
+	for (line = 0; line < INT_MAX; line++)
+	{
+		char* s;
+		if (!source.GetLine(s))
+		{
+			sprintf(szNumber, "%d", line);
+			strError = "The input ended without </osm> after " + string(szNumber) + " lines";
+			return false;
+		}
+		bytes_read_in_pass += source.LastLineBytes();
+		progress.Update(2, bytes_read_in_pass, "way", way_count, "written", ways_written);
+
+		if (strstr(s, "</osm>") != NULL)
+			break;
+
+		if (strstr(s, "<way id=") != NULL)
+		{
+			fSkipThisWay = false;
+			fFoundAtLeastOneIncludedValueInThisWay = false;
+			nNumberOfMandatoryKeysFoundForThisWay = 0;
+			dblSimplifyToleranceForThisWay = 0;
+			strStyleForThisWay = strDefaultStyle;
+			strMifTypeForThisWay = strDefaultMifType;
+			id_of_current_way = LONG_MAX;
+
+			char* id = strstr(s, "<way id=\""), * id_end = (id != NULL ? strstr(id + 9, "\"") : NULL);
+			if (id != NULL && id_end != NULL)
+			{
+				if (!ConvertTextTolong(id + 9, id_of_current_way))
+				{
+					strError = "Could not turn way ID " + string(id + 9, id_end) + " into a numeric ID";
+					return false;
+				}
+
+				values_in_current_way.assign(columns.size(), "");
+				if (nIdColumn >= 0)
+					values_in_current_way[nIdColumn] = string(id + 9, id_end);
+
+				++way_count;
+			}
+		}
+		if (id_of_current_way != LONG_MAX)
+		{
+			ReadKeyValuePairsForWay(s, mapIncludedValues, mapExcludedValues, values_in_current_way, strMifTypeForThisWay, strStyleForThisWay,
+									fBreakUpThisWay, fSkipThisWay, fFoundAtLeastOneIncludedValueInThisWay, nNumberOfMandatoryKeysFoundForThisWay,
+									dblSimplifyToleranceForThisWay);
+
+			if (strstr(s, "</way>") != NULL)
+			{
+				int nShardOfThisWay = -1;
+				if (pShardPlan != NULL && !fSkipThisWay && fFoundAtLeastOneIncludedValueInThisWay && nNumberOfMandatoryKeysFoundForThisWay >= 1)
+					nShardOfThisWay = WayShard(id_of_current_way, nodes_in_each_way, ways_in_other_shards, nodes, nodes_in_other_shards, *pShardPlan);
+
+				if (nShardOfThisWay == -2 || (nShardOfThisWay >= 0 && nShardOfThisWay != m_config.m_nShard))
+					m_counts.m_nWaysInOtherShards++;
+				else if (!fSkipThisWay && fFoundAtLeastOneIncludedValueInThisWay && nNumberOfMandatoryKeysFoundForThisWay >= 1
+						 && HasValuesOfItsMultipolygon(id_of_current_way, values_in_current_way, nIdColumn, multipolygon_members))
+					m_counts.m_nMemberWaysInMultipolygons++;
+				else if (!fSkipThisWay && fFoundAtLeastOneIncludedValueInThisWay && nNumberOfMandatoryKeysFoundForThisWay >= 1)
+				{
+					bool fWaysWritten = false;
+
+					if (nodes_in_each_way.count(id_of_current_way) > 0 && nodes_in_each_way[id_of_current_way].size() > 1)
+					{
+						vector<pair<double,double> > latlons;
+						vector<bool> intersections;
+						bool fIsRegion = (strMifTypeForThisWay == "Region" || strMifTypeForThisWay == "region");
+
+						RelationsItPair itRelations = relations.equal_range(id_of_current_way);
+
+						int i = 0, prev_intersection_i = -1;
+						for (vector<long>::iterator it = nodes_in_each_way[id_of_current_way].begin(); it != nodes_in_each_way[id_of_current_way].end(); it++, i++)
+						{
+							pair<double,double> latlon;
+							if (nodes.Find(*it, latlon))
+							{
+								latlons.push_back(latlon);
+								intersections.push_back(way_counts[*it] > 1);
+
+								if (i > 0 && (i == nodes_in_each_way[id_of_current_way].size() - 1 || fBreakUpThisWay && way_counts[*it] > 1) && latlons.size() > 1)
+								{
+									// this is the last node of the way, or this node represents an intersection (if we are breaking up ways)
+									ways_written++;
+									fWaysWritten = true;
+
+									if (dblSimplifyToleranceForThisWay > 0)
+										nodes_simplified_away += SimplifyLatLons(latlons, intersections, dblSimplifyToleranceForThisWay, fIsRegion);
+									nodes_written += latlons.size();
+
+									if (fProcessRelations)
+										strRestrictions = GetRelationData(itRelations, nodes_in_each_way, id_of_current_way, i, nodes, 
+																		  nRestrictionsWrittenCount, nRestrictionsInWaysCount, false)
+														  + GetRelationData(itRelations, nodes_in_each_way, id_of_current_way, prev_intersection_i, nodes, 
+																		  nRestrictionsWrittenCount, nRestrictionsInWaysCount, true);
+
+									OSM2MIFRecord record;
+									record.m_fIsRegion = fIsRegion;
+									record.m_pStyle = &strStyleForThisWay;
+									record.m_rings = OSM2MIFSpan<vector<pair<double,double> > >(&latlons, 1);
+									record.m_values = OSM2MIFSpan<string>(values_in_current_way);
+									record.m_pRestrictions = (fProcessRelations ? &strRestrictions : NULL);
+									if (!sink.Record(record, strError))
+										return false;
+
+									latlons.erase(latlons.begin(), latlons.end() - 1);
+									intersections.erase(intersections.begin(), intersections.end() - 1);
+									prev_intersection_i = i;
+								}
+							}
+						}
+					}
+
+					if (!fWaysWritten)
+						ways_skipped++;
+				}
+
+				id_of_current_way = LONG_MAX;
+			}
+		}
+	}
+
+	// when converting one shard, only its own multipolygons are written
+	vector<Relation*> multipolygons_to_write;
+	for (vector<Relation*>::iterator itRelation = multipolygons.begin(); itRelation != multipolygons.end(); itRelation++)
+	{
+		int nShardOfRelation = -1;
+		for (vector<long>::iterator it = (*itRelation)->m_outer_way_ids.begin(); pShardPlan != NULL && nShardOfRelation == -1 
+			 && it != (*itRelation)->m_outer_way_ids.end(); it++)
+			nShardOfRelation = WayShard(*it, nodes_in_each_way, ways_in_other_shards, nodes, nodes_in_other_shards, *pShardPlan);
+
+		if (nShardOfRelation == -2 || (nShardOfRelation >= 0 && nShardOfRelation != m_config.m_nShard))
+			m_counts.m_nMultipolygonsInOtherShards++;
+		else
+			multipolygons_to_write.push_back(*itRelation);
+	}
+
+	if (!WriteMultipolygonRelations(sink, multipolygons_to_write, nodes_in_each_way, nodes, way_counts, fProcessRelations,
+									m_counts.m_nMultipolygonsWritten, m_counts.m_nOpenRings, m_counts.m_nOrphanInnerRings, nodes_written, 
+									nodes_simplified_away, strError))
+		return false;
+	bytes_read += bytes_read_in_pass;
+
+	m_stats.StartPhase("flush");
+	if (!sink.End(strError))
+		return false;
+	m_stats.EndPhase();
+
+	m_counts.m_nLines = line;
+	m_counts.m_nMultipolygons = (int)multipolygons_to_write.size();
+	m_counts.m_nWaysWithRestrictions = (int)relations.size();
+	m_counts.m_nBytesRead = bytes_read;
+
+	double dblNodeSeconds = m_stats.PhaseWallSeconds("node parse"), dblWaySeconds = m_stats.PhaseWallSeconds("emission");
+	m_stats.Set("input", "bytes", (double)input_bytes);
+	m_stats.Set("input", "bytes_read", (double)bytes_read);
+	m_stats.Set("input", "lines", pass_1_lines);
+	m_stats.Set("input", "nodes", node_count);
+	m_stats.Set("input", "nodes_skipped", nodes_skipped);
+	m_stats.Set("input", "ways", way_count);
+	m_stats.Set("input", "multipolygon_relations", (double)multipolygons.size());
+	m_stats.Set("throughput", "input_mb_per_second", bytes_read / (1024.0 * 1024.0) / max(1e-9, m_stats.TotalWallSeconds()));
+	m_stats.Set("throughput", "nodes_per_second", node_count / max(1e-9, dblNodeSeconds));
+	m_stats.Set("throughput", "ways_per_second", way_count / max(1e-9, dblWaySeconds));
+	m_stats.Set("throughput", "records_per_second", ways_written / max(1e-9, dblWaySeconds));
+
+	if (m_config.m_fDetailedStatistics)
+	{
+		long way_node_ids = 0;
+		for (map<long, vector<long> >::iterator it = nodes_in_each_way.begin(); it != nodes_in_each_way.end(); it++)
+			way_node_ids += it->second.size();
+
+		m_stats.Set("containers", "node_locations", (double)nodes.Size());
+		m_stats.Set("containers", "node_store_bytes", (double)nodes.MemoryBytes());
+		m_stats.Set("containers", "way_counts", (double)way_counts.size());
+		m_stats.Set("containers", "nodes_in_each_way", (double)nodes_in_each_way.size());
+		m_stats.Set("containers", "nodes_in_each_way_node_ids", way_node_ids);
+		m_stats.Set("containers", "restriction_relations", (double)relations.size());
+		m_stats.Set("containers", "multipolygons", (double)multipolygons.size());
+	}
+
+	return true;
+}
+
+
+MidMifFileSink::MidMifFileSink(const string& strOutFile)
+	: m_strOutFile(strOutFile), m_pWriter(NULL), m_fHilbertSort(false), m_fHasRestrictions(false), m_nSortBufferBytes(0), m_nRecords(0),
+	  m_nMidBytesWritten(0), m_nMifBytesWritten(0)
+{
+}
+
+MidMifFileSink::~MidMifFileSink()
+{
+	delete m_pWriter;
+}
+
+void MidMifFileSink::EnableHilbertSort(size_t nMaxBufferBytes)
+{
+	m_fHilbertSort = true;
+	m_nSortBufferBytes = nMaxBufferBytes;
+}
+
+int MidMifFileSink::SortRunsSpilled()
+{
+	return (m_pWriter != NULL ? m_pWriter->RunFilesWritten() : 0);
+}
+
+bool MidMifFileSink::Begin(const vector<OSM2MIFColumn>& columns, bool fHasRestrictions, string& strError)
+{
+	m_outMid.open(MidFileName().c_str(), ios::trunc);
+	m_outMif.open(MifFileName().c_str(), ios::trunc);
+	if (!m_outMid.good())
+	{
+		strError = "Could not open " + MidFileName() + " for writing";
+		return false;
+	}
+	if (!m_outMif.good())
+	{
+		strError = "Could not open " + MifFileName() + " for writing";
+		return false;
+	}
+
+	delete m_pWriter;
+	m_pWriter = new MidMifRecordWriter(m_outMid, m_outMif);
+	if (m_fHilbertSort)
+		m_pWriter->EnableHilbertSort(m_strOutFile + ".sort", m_nSortBufferBytes);
+	m_fHasRestrictions = fHasRestrictions;
+	m_nRecords = 0;
+
+	m_outMif << "Version 300" << endl;
+	m_outMif << "Charset \"Neutral\"" << endl;
+	m_outMif << "Delimiter \",\"" << endl;
+	m_outMif << "CoordSys Earth Projection 1, 74 Bounds (-1000, -1000) (1000, 1000)" << endl;
+	m_outMif << "Columns " << columns.size() + 1 << endl;
+	for (vector<OSM2MIFColumn>::const_iterator itColumn = columns.begin(); itColumn != columns.end(); itColumn++)
+		m_outMif << "    " << itColumn->m_strName << " " << itColumn->m_strType << endl;
+	if (fHasRestrictions)
+		m_outMif << "    Restrictions Char(250)" << endl;
+	m_outMif << "Data" << endl;
+	return true;
+}
+
+bool MidMifFileSink::Record(const OSM2MIFRecord& record, string& strError)
+{
+	if (record.m_pRestrictions != NULL)
+		m_strRestrictions = "\"" + *record.m_pRestrictions + "\"";
+	else
+		m_strRestrictions.clear();
+
+	if (record.m_fIsRegion)
+		WriteMidMifRegionRecord(m_pWriter->Mid(), m_pWriter->Mif(), *record.m_pStyle, record.m_rings, record.m_values, m_fHasRestrictions,
+								m_strRestrictions);
+	else
+		WriteMidMifRecord(m_pWriter->Mid(), m_pWriter->Mif(), "Pline", *record.m_pStyle, record.m_rings[0], record.m_values,
+						  m_fHasRestrictions, m_strRestrictions);
+	if (!m_pWriter->EndRecord(record.m_rings, strError))
+		return false;
+
+	// flushing is important to keep peak memory usage low (otherwise the streams consume lots of memory)
+	if (++m_nRecords % 10000 == 0)
+	{
+		m_outMid.flush();
+		m_outMif.flush();
+	}
+	return true;
+}
+
+bool MidMifFileSink::End(string& strError)
+{
+	if (!m_pWriter->Finish(strError))
+		return false;
+	m_nMidBytesWritten = m_outMid.tellp();
+	m_nMifBytesWritten = m_outMif.tellp();
+	m_outMid.close();
+	m_outMif.close();
+	return true;
+}
+
+
+int OSM2MIFShardPlan::ShardOfLongitude(double lon) const
+{
+	// the first shard whose strip ends east of lon
+	int nLow = 0, nHigh = (int)m_shards.size() - 1;
+	while (nLow < nHigh)
+	{
+		int nMiddle = (nLow + nHigh) / 2;
+		if (lon < m_shards[nMiddle].m_east)
+			nHigh = nMiddle;
+		else
+			nLow = nMiddle + 1;
+	}
+	return nLow;
+}
+
+bool OSM2MIFShardPlan::Write(const string& strFile, string& strError) const
+{
+	FILE* out = fopen(strFile.c_str(), "w");
+	if (out == NULL)
+	{
+		strError = "Could not open " + strFile + " for writing";
+		return false;
+	}
+
+	// longitudes are written with enough digits to read back exactly, so every worker puts a node in the same strip
+	fprintf(out, "// OSM2MIF shard plan: one line per shard of\n");
+	fprintf(out, "//     shard  west  east  halo_west  halo_east  nodes_in_strip  ways_owned  number_of_outside_ways  outside_way_ids...\n");
+	fprintf(out, "shards %d\n", (int)m_shards.size());
+	for (int i = 0; i < (int)m_shards.size(); i++)
+	{
+		fprintf(out, "%d %.17g %.17g %.17g %.17g %ld %ld %d", i, m_shards[i].m_west, m_shards[i].m_east, m_shards[i].m_halo_west,
+				m_shards[i].m_halo_east, m_shards[i].m_nNodes, m_shards[i].m_nWays, (int)m_shards[i].m_outside_way_ids.size());
+		for (vector<long>::const_iterator it = m_shards[i].m_outside_way_ids.begin(); it != m_shards[i].m_outside_way_ids.end(); it++)
+			fprintf(out, " %ld", *it);
+		fprintf(out, "\n");
+	}
+
+	bool fOK = (ferror(out) == 0);
+	fclose(out);
+	if (!fOK)
+		strError = "Could not write to " + strFile;
+	return fOK;
+}
+
+bool OSM2MIFShardPlan::Read(const string& strFile, string& strError)
+{
+	ifstream in(strFile.c_str());
+	if (!in.good())
+	{
+		strError = "Could not open " + strFile + " for reading";
+		return false;
+	}
+
+	m_shards.clear();
+	int nShards = -1;
+	string strLine;
+	while (getline(in, strLine))
+	{
+		if (strLine.empty() || strLine.compare(0, 2, "//") == 0)
+			continue;
+		istringstream line(strLine);
+		if (nShards < 0)
+		{
+			string strKeyword;
+			if (!(line >> strKeyword >> nShards) || strKeyword != "shards" || nShards < 1)
+				break;
+			continue;
+		}
+		int nShard, nOutsideWays;
+		OSM2MIFShard shard;
+		if (!(line >> nShard >> shard.m_west >> shard.m_east >> shard.m_halo_west >> shard.m_halo_east >> shard.m_nNodes >> shard.m_nWays
+			  >> nOutsideWays) || nShard != (int)m_shards.size() || nOutsideWays < 0)
+			break;
+		shard.m_outside_way_ids.resize(nOutsideWays);
+		for (int i = 0; i < nOutsideWays && line >> shard.m_outside_way_ids[i]; i++)
+			;
+		if (!line)
+			break;
+		m_shards.push_back(shard);
+	}
+	if (nShards < 1 || (int)m_shards.size() != nShards)
+	{
+		strError = "Invalid shard plan file " + strFile;
+		return false;
+	}
+	return true;
+}
+
+// A way as the planning pass sees it: the longitude of its first node in the bounding box, the longitudes it spans and
+// whether the config's rules write it
+class PlannedWay
+{
+public:
+	long m_id;
+	double m_first_lon, m_west, m_east;
+	bool m_fWritten;
+	bool operator<(const PlannedWay& other) const { return m_id < other.m_id; }
+};
+
+// A banned turn on a way a shard writes: GetRelationData() needs the node after the via node in the 'to' way
+class PlannedTurn
+{
+public:
+	long m_to_way_id, m_node_via_id;
+	int m_nShard;
+	bool operator<(const PlannedTurn& other) const { return m_to_way_id < other.m_to_way_id; }
+};
+
+// The planned way with this id, or NULL if it has no node in the bounding box.  The ways must be sorted.
+PlannedWay* FindPlannedWay(vector<PlannedWay>& ways, long id)
+{
+	PlannedWay key;
+	key.m_id = id;
+	vector<PlannedWay>::iterator itWay = lower_bound(ways.begin(), ways.end(), key);
+	return (itWay != ways.end() && itWay->m_id == id ? &*itWay : NULL);
+}
+
+bool PlanShards(OSMInputSource& source, OSM2MIFConfig& config, int nShards, OSM2MIFShardPlan& plan, string& strError)
+{
+	if (nShards < 1)
+	{
+		strError = "The number of shards must be at least 1";
+		return false;
+	}
+	if (!source.Open(strError))
+		return false;
+
+	double min_lon = config.m_min_lon, min_lat = config.m_min_lat, max_lon = config.m_max_lon, max_lat = config.m_max_lat;
+	vector<pair<long, double> > node_lons;		// (id, longitude) of the nodes in the bounding box, sorted by id once the ways start
+	bool fNodeLonsSorted = true, fStripsMade = false;
+	vector<PlannedWay> ways;
+	bool fWaysSorted = true;
+	vector<PlannedTurn> turns;
+	vector<double> needed_west, needed_east;	// the extent each shard's halo has to cover
+
+	// the ways' and relations' tags are read as Convert reads them, into columns numbered the same way
+	int nColumns = 0;
+	for (map<string, ParameterValues*>::iterator itKey = config.m_mapIncludedValues.begin(); itKey != config.m_mapIncludedValues.end(); itKey++)
+		itKey->second->m_nColumn = nColumns++;
+
+	vector<long> nodes_in_current_way;
+	vector<string> values(nColumns);
+	string strMifType, strStyle;
+	bool fBreakUp, fSkip = false, fFoundAtLeastOneIncludedValue = false;
+	int nNumberOfMandatoryKeysFound = 0;
+	double dblSimplifyTolerance = 0;
+	long id_of_current_way = LONG_MAX;
+	Relation relation;
+	bool fInRelation = false;
+
+	for (int line = 0; line < INT_MAX; line++)
+	{
+		char* s;
+		if (!source.GetLine(s))
+		{
+			char szNumber[32];
+			sprintf(szNumber, "%d", line);
+			strError = "The input ended without </osm> after " + string(szNumber) + " lines";
+			return false;
+		}
+
+		bool fEnd = (strstr(s, "</osm>") != NULL);
+
+		// all the nodes have been read: split them into strips with about the same number of nodes each, from a histogram of longitude
+		if (!fStripsMade && (fEnd || strstr(s, "<way id=") != NULL || strstr(s, "<relation id=") != NULL))
+		{
+			fStripsMade = true;
+			if (!fNodeLonsSorted)
+				sort(node_lons.begin(), node_lons.end());
+
+			double west = 0, east = 0;
+			for (vector<pair<long, double> >::iterator it = node_lons.begin(); it != node_lons.end(); it++)
+			{
+				west = (it == node_lons.begin() ? it->second : min(west, it->second));
+				east = (it == node_lons.begin() ? it->second : max(east, it->second));
+			}
+			const int nBins = 65536;
+			double dblBinWidth = max(1e-9, (east - west) / nBins);
+			vector<long> histogram(nBins, 0);
+			for (vector<pair<long, double> >::iterator it = node_lons.begin(); it != node_lons.end(); it++)
+				histogram[min(nBins - 1, (int)((it->second - west) / dblBinWidth))]++;
+
+			plan.m_shards.assign(nShards, OSM2MIFShard());
+			long nCumulative = 0;
+			int nBin = 0;
+			for (int i = 0; i < nShards; i++)
+			{
+				plan.m_shards[i].m_west = (i == 0 ? -1000 : plan.m_shards[i - 1].m_east);
+				if (i == nShards - 1)
+					plan.m_shards[i].m_east = 1000;
+				else
+				{
+					double dblTarget = (double)node_lons.size() * (i + 1) / nShards;
+					while (nBin < nBins && nCumulative + histogram[nBin] <= dblTarget)
+						nCumulative += histogram[nBin++];
+					plan.m_shards[i].m_east = west + nBin * dblBinWidth;
+				}
+				plan.m_shards[i].m_nNodes = plan.m_shards[i].m_nWays = 0;
+			}
+			for (vector<pair<long, double> >::iterator it = node_lons.begin(); it != node_lons.end(); it++)
+				plan.m_shards[plan.ShardOfLongitude(it->second)].m_nNodes++;
+
+			for (int i = 0; i < nShards; i++)
+			{
+				needed_west.push_back(plan.m_shards[i].m_west);
+				needed_east.push_back(plan.m_shards[i].m_east);
+			}
+		}
+
+		if (fEnd)
+			break;
+
+		if (strstr(s, "<node id=") != NULL)
+		{
+			bool fIsNode;
+			long node_id;
+			double latitude, longitude;
+			if (!ReadNode(s, fIsNode, node_id, latitude, longitude, strError))
+				return false;
+			if (fIsNode && IsInBoundingBox(latitude, longitude, min_lon, min_lat, max_lon, max_lat))
+			{
+				if (!node_lons.empty() && node_id < node_lons.back().first)
+					fNodeLonsSorted = false;
+				node_lons.push_back(pair<long, double>(node_id, longitude));
+			}
+		}
+
+		if (strstr(s, "<way id=") != NULL)
+		{
+			id_of_current_way = LONG_MAX;
+			if (!ReadId(s, "<way id=\"", "way ID", id_of_current_way, strError))
+				return false;
+			nodes_in_current_way.clear();
+			fSkip = fFoundAtLeastOneIncludedValue = false;
+			nNumberOfMandatoryKeysFound = 0;
+		}
+
+		if (id_of_current_way != LONG_MAX)
+		{
+			ReadKeyValuePairsForWay(s, config.m_mapIncludedValues, config.m_mapExcludedValues, values, strMifType, strStyle, fBreakUp, fSkip,
+									fFoundAtLeastOneIncludedValue, nNumberOfMandatoryKeysFound, dblSimplifyTolerance);
+
+			long node_id = LONG_MAX;
+			if (!ReadId(s, "<nd ref=\"", "node ID", node_id, strError))
+				return false;
+			if (node_id != LONG_MAX)
+				nodes_in_current_way.push_back(node_id);
+
+			if (strstr(s, "</way>") != NULL)
+			{
+				PlannedWay way;
+				way.m_id = id_of_current_way;
+				way.m_fWritten = (!fSkip && fFoundAtLeastOneIncludedValue && nNumberOfMandatoryKeysFound >= 1);
+				bool fFoundNode = false;
+				for (vector<long>::iterator it = nodes_in_current_way.begin(); it != nodes_in_current_way.end(); it++)
+				{
+					vector<pair<long, double> >::iterator itNode = lower_bound(node_lons.begin(), node_lons.end(), pair<long, double>(*it, -DBL_MAX));
+					if (itNode == node_lons.end() || itNode->first != *it)
+						continue;
+					if (!fFoundNode)
+						way.m_first_lon = way.m_west = way.m_east = itNode->second;
+					fFoundNode = true;
+					way.m_west = min(way.m_west, itNode->second);
+					way.m_east = max(way.m_east, itNode->second);
+				}
+
+				if (fFoundNode)
+				{
+					// every way is remembered, as it could be a multipolygon member, but only the ones written decide the halos
+					if (!ways.empty() && way.m_id < ways.back().m_id)
+						fWaysSorted = false;
+					ways.push_back(way);
+					if (way.m_fWritten)
+					{
+						int nShard = plan.ShardOfLongitude(way.m_first_lon);
+						needed_west[nShard] = min(needed_west[nShard], way.m_west);
+						needed_east[nShard] = max(needed_east[nShard], way.m_east);
+						plan.m_shards[nShard].m_nWays++;
+					}
+				}
+				id_of_current_way = LONG_MAX;
+			}
+		}
+
+		if (strstr(s, "<relation id=") != NULL)
+		{
+			relation = Relation();
+			relation.m_values.assign(nColumns, "");
+			fInRelation = true;
+		}
+
+		if (fInRelation)
+		{
+			if (!ReadRelationMemberOrType(s, &relation, strError))
+				return false;
+			bool fBreakUpThisRelation;
+			ReadKeyValuePairsForWay(s, config.m_mapIncludedValues, config.m_mapExcludedValues, relation.m_values, strMifType,
+									relation.m_strStyle, fBreakUpThisRelation, relation.m_fSkip, relation.m_fFoundAtLeastOneIncludedValue,
+									relation.m_nNumberOfMandatoryKeysFound, relation.m_dblSimplifyTolerance);
+
+			if (strstr(s, "</relation>") != NULL)
+			{
+				if (!fWaysSorted && (IsMultipolygonToWrite(&relation) || IsRestrictionToProcess(&relation)))
+				{
+					sort(ways.begin(), ways.end());
+					fWaysSorted = true;
+				}
+
+				if (IsMultipolygonToWrite(&relation))
+				{
+					// owned by the shard of the first outer way with a node in the bounding box, and needs all its member ways
+					int nShard = -1;
+					for (vector<long>::iterator it = relation.m_outer_way_ids.begin(); nShard < 0 && it != relation.m_outer_way_ids.end(); it++)
+					{
+						PlannedWay* way = FindPlannedWay(ways, *it);
+						if (way != NULL)
+							nShard = plan.ShardOfLongitude(way->m_first_lon);
+					}
+					vector<long> member_way_ids(relation.m_outer_way_ids);
+					member_way_ids.insert(member_way_ids.end(), relation.m_inner_way_ids.begin(), relation.m_inner_way_ids.end());
+					for (vector<long>::iterator it = member_way_ids.begin(); nShard >= 0 && it != member_way_ids.end(); it++)
+					{
+						PlannedWay* way = FindPlannedWay(ways, *it);
+						if (way != NULL)
+						{
+							needed_west[nShard] = min(needed_west[nShard], way->m_west);
+							needed_east[nShard] = max(needed_east[nShard], way->m_east);
+						}
+						else
+							plan.m_shards[nShard].m_outside_way_ids.push_back(*it);
+					}
+				}
+				else if (config.m_fProcessRelations && IsRestrictionToProcess(&relation))
+				{
+					// looked for on each from way by the shard that writes it
+					for (vector<long>::iterator it = relation.m_from_way_ids.begin(); it != relation.m_from_way_ids.end(); it++)
+					{
+						PlannedWay* way = FindPlannedWay(ways, *it);
+						if (way != NULL && way->m_fWritten)
+						{
+							PlannedTurn turn;
+							turn.m_to_way_id = relation.m_to_way_id;
+							turn.m_node_via_id = relation.m_node_via_id;
+							turn.m_nShard = plan.ShardOfLongitude(way->m_first_lon);
+							turns.push_back(turn);
+						}
+					}
+				}
+				fInRelation = false;
+			}
+		}
+	}
+
+	// the 'to' ways of the banned turns have been read before their relations, so read the ways again for the node after each
+	// turn's via node, found as GetRelationData() finds it, and take it into the halo of the shard that writes the turn
+	if (!turns.empty())
+	{
+		sort(turns.begin(), turns.end());
+		if (!source.Open(strError))
+			return false;
+
+		id_of_current_way = LONG_MAX;
+		for (int line = 0; line < INT_MAX; line++)
+		{
+			char* s;
+			if (!source.GetLine(s) || strstr(s, "</osm>") != NULL || strstr(s, "<relation id=") != NULL)
+				break;
+
+			if (strstr(s, "<way id=") != NULL)
+			{
+				id_of_current_way = LONG_MAX;
+				if (!ReadId(s, "<way id=\"", "way ID", id_of_current_way, strError))
+					return false;
+				nodes_in_current_way.clear();
+			}
+
+			if (id_of_current_way != LONG_MAX)
+			{
+				long node_id = LONG_MAX;
+				if (!ReadId(s, "<nd ref=\"", "node ID", node_id, strError))
+					return false;
+				if (node_id != LONG_MAX)
+					nodes_in_current_way.push_back(node_id);
+
+				if (strstr(s, "</way>") != NULL)
+				{
+					PlannedTurn key;
+					key.m_to_way_id = id_of_current_way;
+					pair<vector<PlannedTurn>::iterator, vector<PlannedTurn>::iterator> itTurns = equal_range(turns.begin(), turns.end(), key);
+					for (vector<PlannedTurn>::iterator itTurn = itTurns.first; itTurn != itTurns.second; itTurn++)
+					{
+						vector<long>::iterator itVia = find(nodes_in_current_way.begin(), nodes_in_current_way.end(), itTurn->m_node_via_id);
+						if (itVia == nodes_in_current_way.end() || nodes_in_current_way.size() < 2)
+							continue;
+						long next_node_id = (itVia != nodes_in_current_way.end() - 1 ? *(itVia + 1) : *(itVia - 1));
+
+						vector<pair<long, double> >::iterator itNode = lower_bound(node_lons.begin(), node_lons.end(), pair<long, double>(next_node_id, -DBL_MAX));
+						if (itNode != node_lons.end() && itNode->first == next_node_id)
+						{
+							needed_west[itTurn->m_nShard] = min(needed_west[itTurn->m_nShard], itNode->second);
+							needed_east[itTurn->m_nShard] = max(needed_east[itTurn->m_nShard], itNode->second);
+						}
+					}
+					id_of_current_way = LONG_MAX;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < nShards; i++)
+	{
+		plan.m_shards[i].m_halo_west = needed_west[i];
+		plan.m_shards[i].m_halo_east = needed_east[i];
+		vector<long>& outside_way_ids = plan.m_shards[i].m_outside_way_ids;
+		sort(outside_way_ids.begin(), outside_way_ids.end());
+		outside_way_ids.erase(unique(outside_way_ids.begin(), outside_way_ids.end()), outside_way_ids.end());
+	}
+	return true;
+}
+
+string ShardOutputFileName(const string& strOutFile, int nShard)
+{
+	char szShard[32];
+	sprintf(szShard, ".shard%d", nShard);
+	return strOutFile + szShard;
+}
+
+bool MergeShards(const string& strOutFile, int nShards, string& strError)
+{
+	string strOutFileMid = strOutFile + ".mid", strOutFileMif = strOutFile + ".mif";
+	ofstream outMid(strOutFileMid.c_str(), ios::binary | ios::trunc), outMif(strOutFileMif.c_str(), ios::binary | ios::trunc);
+	if (!outMid.good() || !outMif.good())
+	{
+		strError = "Could not open " + (outMid.good() ? strOutFileMif : strOutFileMid) + " for writing";
+		return false;
+	}
+
+	string strHeader;
+	for (int i = 0; i < nShards; i++)
+	{
+		string strShardMid = ShardOutputFileName(strOutFile, i) + ".mid", strShardMif = ShardOutputFileName(strOutFile, i) + ".mif";
+		ifstream inMid(strShardMid.c_str(), ios::binary), inMif(strShardMif.c_str(), ios::binary);
+		if (!inMid.good() || !inMif.good())
+		{
+			strError = "Could not open " + (inMid.good() ? strShardMif : strShardMid) + " for reading";
+			return false;
+		}
+
+		// the mif header, up to the "Data" line, is written once and must be the same in every shard
+		string strShardHeader, strLine;
+		bool fFoundData = false;
+		while (!fFoundData && getline(inMif, strLine))
+		{
+			strShardHeader += strLine + "\n";
+			fFoundData = (strLine == "Data" || strLine == "Data\r");
+		}
+		if (!fFoundData)
+		{
+			strError = strShardMif + " has no Data line";
+			return false;
+		}
+		if (i == 0)
+		{
+			strHeader = strShardHeader;
+			outMif << strHeader;
+		}
+		else if (strShardHeader != strHeader)
+		{
+			strError = "The header of " + strShardMif + " is different from that of the first shard";
+			return false;
+		}
+
+		// (copying an empty stream buffer would set the output's failbit)
+		if (inMif.peek() != ifstream::traits_type::eof())
+			outMif << inMif.rdbuf();
+		if (inMid.peek() != ifstream::traits_type::eof())
+			outMid << inMid.rdbuf();
+	}
+
+	outMid.close();
+	outMif.close();
+	if (outMid.fail() || outMif.fail())
+	{
+		strError = "Could not write to " + (outMid.fail() ? strOutFileMid : strOutFileMif);
+		return false;
+	}
+	return true;
+}
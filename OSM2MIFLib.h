@@ -0,0 +1,435 @@
+#ifndef OSM2MIF_LIB_H
+#define OSM2MIF_LIB_H
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+
+// OSM2MIF as a library.  A conversion reads an OSM XML input (OSMInputSource - a file or a buffer in memory) twice, with the rules
+// in an OSM2MIFConfig, and passes each polyline segment and region it produces to an OSM2MIFSink.  MidMifFileSink writes them to
+// mid/mif files, which is what the OSM2MIF command line does; other sinks can take the records in-process, without any text output.
+//
+//     OSM2MIFConfig config;
+//     OSMFileSource source("input.osm");
+//     MidMifFileSink sink("output");
+//     if (!config.ReadParametersFile("parameters.txt", strError) || !OSM2MIFConverter(config).Convert(source, sink, strError))
+//         ...
+
+
+// Read a line from an input stream into szBuffer (LINE_BUFFER_LENGTH long, see OSM2MIFLib.cpp), or into a shared static buffer
+bool GetLineFromFile(std::istream& In, char* szBuffer, char*& szLine, bool fAllowEmptyLine = false);
+bool GetLineFromFile(std::istream& In, char*& szLine, bool fAllowEmptyLine = false);
+
+// A read-only view onto an array owned by the converter
+template <class T> class OSM2MIFSpan
+{
+public:
+	OSM2MIFSpan() : m_pData(NULL), m_nSize(0) {}
+	OSM2MIFSpan(const T* pData, size_t nSize) : m_pData(pData), m_nSize(nSize) {}
+	OSM2MIFSpan(const std::vector<T>& v) : m_pData(v.empty() ? NULL : &v[0]), m_nSize(v.size()) {}
+	const T* begin() const { return m_pData; }
+	const T* end() const { return m_pData + m_nSize; }
+	size_t size() const { return m_nSize; }
+	bool empty() const { return m_nSize == 0; }
+	const T& operator[](size_t i) const { return m_pData[i]; }
+private:
+	const T* m_pData;
+	size_t m_nSize;
+};
+
+// Convert a string to a long, returning false if conversion failed
+bool ConvertTextTolong(const char* szValue, long& lValue);
+
+// Convert a string to a double, returning false if conversion failed
+bool ConvertTextToDouble(const char* szValue, double& dblValue);
+
+// This class stores parameter information as specified in the parameters file
+class ParameterValues
+{
+public:
+	ParameterValues(bool fIsMandatory = false)
+	{
+		m_fIsAll = false;
+		m_fIsMandatory = fIsMandatory;
+		m_nColumn = -1;
+	}
+	bool m_fIsAll;
+	bool m_fIsMandatory;
+	std::set<std::string> m_setValues;	// the values to be retrieved for this key.  May contain '*' meaning all values.
+	int m_nColumn;						// for included keys, the output column the key's values go in
+
+	// the following maps store style, transformation, mif type etc for each included value string
+	std::map<std::string, std::string> m_mapDrawStyle;
+	std::map<std::string, std::string> m_mapTransform;
+	std::map<std::string, std::string> m_mapMifType;
+	std::map<std::string, std::string> m_mapTypes;
+	std::map<std::string, std::string> m_mapBreakUp;
+	std::map<std::string, double> m_mapSimplifyTolerance;
+};
+
+// Read the parameters file (the format is described in OSM2MIFLib.cpp).  The included keys are numbered as output columns in key order.
+bool ReadParametersFile(std::string strParametersFile, double& min_lon, double& min_lat, double& max_lon, double& max_lat,
+						std::map<std::string, ParameterValues*>& mapIncludedValues, std::map<std::string, ParameterValues*>& mapExcludedValues,
+						std::string& strError);
+
+// class to store relation data
+class Relation
+{
+public:
+	Relation()
+	{
+		m_to_way_id = -1;
+		m_node_via_id = -1;
+		m_fIsRestriction = false;
+		m_fIsMultipolygon = false;
+		m_fSkip = false;
+		m_fFoundAtLeastOneIncludedValue = false;
+		m_nNumberOfMandatoryKeysFound = 0;
+		m_dblSimplifyTolerance = 0;
+	}
+	std::vector<long> m_from_way_ids;
+	long m_to_way_id, m_node_via_id;
+	bool m_fIsRestriction;
+
+	// multipolygon and boundary relations: the member ways by role, plus the included values and style picked up from the relation's tags
+	std::string m_strId;
+	bool m_fIsMultipolygon;
+	std::vector<long> m_outer_way_ids, m_inner_way_ids;
+	std::vector<std::string> m_values;
+	std::string m_strStyle;
+	bool m_fSkip, m_fFoundAtLeastOneIncludedValue;
+	int m_nNumberOfMandatoryKeysFound;
+	double m_dblSimplifyTolerance;
+};
+
+typedef std::pair<std::multimap<long,Relation*>::iterator, std::multimap<long,Relation*>::iterator> RelationsItPair;
+
+// The locations of the nodes in the bounding box, by id.  Uncompressed, they are kept in a map.  Compressed, they are kept as
+// 1e-7 degree fixed point (which is exact for osm files, whose coordinates have 7 decimal places) in blocks of BLOCK_NODES
+// consecutive nodes, with each node's id, latitude and longitude stored as zig-zag varint deltas from the node before.  A directory of
+// the blocks' first and last ids finds a block by binary search, and the last few blocks decoded are cached, so lookups of nodes that
+// are near each other in a way rarely decode anything.  Nodes that arrive out of id order go in the map instead.
+class NodeStore
+{
+public:
+	NodeStore(bool fCompress = false);
+	~NodeStore();
+
+	void Add(long id, double lat, double lon);
+	bool Find(long id, std::pair<double,double>& latlon);
+	// (0, 0) if the node isn't stored
+	std::pair<double,double> LatLon(long id);
+
+	long Size() { return m_nSize; }
+	long long MemoryBytes();		// approximate
+
+private:
+	enum { BLOCK_NODES = 64, CACHED_BLOCKS = 256, CHUNK_BYTES = 1024 * 1024 };
+	class Block
+	{
+	public:
+		long m_first_id, m_last_id;
+		int m_lat, m_lon;				// of the first node; the rest are deltas
+		const unsigned char* m_pData;	// the deltas of the other nodes
+		int m_nNodes;
+	};
+	class DecodedBlock
+	{
+	public:
+		int m_nBlock, m_nNodes;
+		long m_ids[BLOCK_NODES];
+		int m_lats[BLOCK_NODES], m_lons[BLOCK_NODES];
+	};
+
+	void EncodeBlock();
+	void DecodeBlock(int nBlock, DecodedBlock& decoded);
+	static bool FindInBlock(const DecodedBlock& block, long id, std::pair<double,double>& latlon);
+
+	bool m_fCompress;
+	long m_nSize;
+	std::map<long, std::pair<double,double> > m_mapNodes;	// all the nodes if uncompressed, else only those out of id order
+	std::vector<Block> m_blocks;
+	std::vector<unsigned char*> m_chunks;					// the encoded blocks, in CHUNK_BYTES pieces so they never need reallocating
+	size_t m_nChunkBytesUsed;
+	DecodedBlock m_pending;									// nodes not yet encoded (m_nBlock is -1)
+	std::vector<DecodedBlock> m_cache;						// indexed by block number modulo CACHED_BLOCKS
+
+	NodeStore(const NodeStore&);
+	NodeStore& operator=(const NodeStore&);
+};
+
+// The building blocks of a conversion (also used by the benchmarks)
+std::string ReplaceApostrophesAndAmpersands(std::string str);
+void WriteMidRecord(std::ostream& outMid, OSM2MIFSpan<std::string> values, bool fWriteRelations, const std::string& strRelationData);
+void WriteMidMifRecord(std::ostream& outMid, std::ostream& outMif, const std::string& strMifTypeForThisWay,
+					   const std::string& strStyleForThisWay, const std::vector<std::pair<double,double> >& latlons,
+					   OSM2MIFSpan<std::string> values_in_current_way, bool fWriteRelations, const std::string& strRelationData);
+void WriteMidMifRegionRecord(std::ostream& outMid, std::ostream& outMif, const std::string& strStyle,
+							 OSM2MIFSpan<std::vector<std::pair<double,double> > > rings, OSM2MIFSpan<std::string> values,
+							 bool fWriteRelations, const std::string& strRelationData);
+int SimplifyLatLons(std::vector<std::pair<double,double> >& latlons, std::vector<bool>& fixed, double dblTolerance, bool fIsRegion);
+std::string GetRelationData(RelationsItPair& itRelations, std::map<long, std::vector<long> >& nodes_in_each_way,
+					   long id_of_from_way, int nUptoNodeInFromWay,
+					   NodeStore& nodes,
+					   int& nRelationsWritten, int& nRelationsFound, bool fLookAtNextNodeInWayToDetermineIfIsRightTurn);
+void ReadKeyValuePairsForWay(char*& s, std::map<std::string, ParameterValues*>& mapIncludedValues,
+							std::map<std::string, ParameterValues*>& mapExcludedValues,
+							std::vector<std::string>& values_in_current_way, std::string& strMifTypeForThisWay, std::string& strStyleForThisWay,
+							bool& fBreakUpThisWay, bool& fSkipThisWay, bool& fFoundAtLeastOneIncludedValueInThisWay,
+							int& nNumberOfMandatoryKeysFoundForThisWay, double& dblSimplifyToleranceForThisWay);
+
+// Peak resident set size of this process so far, in kilobytes
+long GetPeakRSSKilobytes();
+
+// User plus system CPU time used by this process so far, in seconds
+double GetProcessCPUSeconds();
+
+// Wall and CPU time of each phase of a run, plus named counters grouped into sections, for the run summary and the optional
+// JSON stats file.  Timing only happens at phase boundaries, so it costs nothing measurable.
+class RunStatistics
+{
+public:
+	RunStatistics();
+
+	// end the current phase (if any) and start timing the next one
+	void StartPhase(const std::string& strName);
+	void EndPhase();
+	double PhaseWallSeconds(const std::string& strName);
+	double TotalWallSeconds();
+	// put the phases and values of 'earlier' (e.g. work timed before Convert()) in front of these
+	void Prepend(const RunStatistics& earlier);
+
+	void Set(const std::string& strSection, const std::string& strName, double dblValue);
+	void PrintPhases();
+	bool WriteJson(const std::string& strFile, std::string& strError);
+
+private:
+	class PhaseTimes
+	{
+	public:
+		std::string m_strName;
+		double m_dblWallStart, m_dblCPUStart, m_dblWallSeconds, m_dblCPUSeconds;
+	};
+	class StatValue
+	{
+	public:
+		std::string m_strSection, m_strName;
+		double m_dblValue;
+	};
+
+	std::vector<PhaseTimes> m_phases;
+	int m_nCurrentPhase;
+	std::vector<StatValue> m_values;
+};
+
+
+// An output column: an included key from the parameters file and its mif type (e.g. "Char(250)", "Integer")
+class OSM2MIFColumn
+{
+public:
+	std::string m_strName, m_strType;
+};
+
+// One polyline segment or region as it is emitted.  All members are views onto the converter's own buffers, so nothing is copied,
+// and they are only valid during the OSM2MIFSink::Record() call.
+class OSM2MIFRecord
+{
+public:
+	bool m_fIsRegion;
+	const std::string* m_pStyle;									// the mif pen/brush clause
+	OSM2MIFSpan<std::vector<std::pair<double,double> > > m_rings;	// (lat, lon) pairs.  A polyline has a single 'ring'; a region has each
+																	// outer ring followed by its inner rings, all closed.
+	OSM2MIFSpan<std::string> m_values;								// one per column, in the order the columns were passed to Begin()
+	const std::string* m_pRestrictions;								// ';' separated 'to' way ids of banned turns, or NULL without restrictions
+};
+
+// Receives the output of a conversion
+class OSM2MIFSink
+{
+public:
+	virtual ~OSM2MIFSink() {}
+	virtual bool Begin(const std::vector<OSM2MIFColumn>& /*columns*/, bool /*fHasRestrictions*/, std::string& /*strError*/) { return true; }
+	virtual bool Record(const OSM2MIFRecord& record, std::string& strError) = 0;
+	virtual bool End(std::string& /*strError*/) { return true; }
+};
+
+// An OSM XML input, read a line at a time.  The converter reads it twice, calling Open() before each pass.
+class OSMInputSource
+{
+public:
+	virtual ~OSMInputSource() {}
+	virtual bool Open(std::string& strError) = 0;
+	// the next line, or false at the end of the input (or at an empty line, as for files)
+	virtual bool GetLine(char*& szLine) = 0;
+	// bytes consumed by the last GetLine(), including the line end
+	virtual long long LastLineBytes() = 0;
+	virtual long long Size() = 0;
+};
+
+class OSMFileSource : public OSMInputSource
+{
+public:
+	OSMFileSource(const std::string& strFile);
+	bool Open(std::string& strError);
+	bool GetLine(char*& szLine);
+	long long LastLineBytes() { return m_in.gcount(); }
+	long long Size() { return m_nSize; }
+private:
+	std::string m_strFile;
+	std::ifstream m_in;
+	std::vector<char> m_buffer;
+	long long m_nSize;
+};
+
+// Reads OSM XML straight from a caller's buffer, which must stay alive and unchanged during the conversion.  Only the current line
+// is copied (the parsing needs it nul terminated).
+class OSMMemorySource : public OSMInputSource
+{
+public:
+	OSMMemorySource(const char* pData, size_t nLength);
+	bool Open(std::string& strError);
+	bool GetLine(char*& szLine);
+	long long LastLineBytes() { return m_nLastLineBytes; }
+	long long Size() { return m_nLength; }
+private:
+	const char* m_pData;
+	size_t m_nLength, m_nPosition;
+	long long m_nLastLineBytes;
+	std::vector<char> m_buffer;
+};
+
+// One spatial partition of a sharded conversion: a strip of longitude, and the wider 'halo' strip whose nodes the shard's worker
+// keeps so that every way and multipolygon it owns is complete.  A way belongs to the shard whose strip holds its first node inside
+// the bounding box; a multipolygon to the shard of its first outer way that has one.
+class OSM2MIFShard
+{
+public:
+	double m_west, m_east;				// the first shard starts at -1000 and the last ends at 1000, so every longitude is in a strip
+	double m_halo_west, m_halo_east;
+	long m_nNodes, m_nWays;				// nodes in the strip and ways owned, as found by the planning pass
+	std::vector<long> m_outside_way_ids;	// member ways of its multipolygons with no node in the bounding box, in id order
+};
+
+class OSM2MIFShardPlan
+{
+public:
+	std::vector<OSM2MIFShard> m_shards;
+
+	int ShardOfLongitude(double lon) const;
+	bool Write(const std::string& strFile, std::string& strError) const;
+	bool Read(const std::string& strFile, std::string& strError);
+};
+
+// The settings for a conversion: the bounding box and the key/value rules (usually from a parameters file) plus run options
+class OSM2MIFConfig
+{
+public:
+	OSM2MIFConfig();
+	~OSM2MIFConfig();
+
+	bool ReadParametersFile(const std::string& strParametersFile, std::string& strError);
+
+	double m_min_lon, m_min_lat, m_max_lon, m_max_lat;	// LONG_MAX if there is no bounding box
+	std::map<std::string, ParameterValues*> m_mapIncludedValues, m_mapExcludedValues;
+	bool m_fProcessRelations;		// work out banned turns from the restriction relations
+	bool m_fProgress;				// print progress to stdout while reading
+	bool m_fDetailedStatistics;		// also measure the container sizes at the end (walks the way list once more)
+	bool m_fCompressNodes;			// keep the node locations in a compressed NodeStore (slower lookups, much less memory)
+	const OSM2MIFShardPlan* m_pShardPlan;	// if not NULL, only convert the ways and multipolygons of shard m_nShard of this plan
+	int m_nShard;
+
+private:
+	OSM2MIFConfig(const OSM2MIFConfig&);
+	OSM2MIFConfig& operator=(const OSM2MIFConfig&);
+};
+
+// The element counts of a conversion
+class OSM2MIFRunCounts
+{
+public:
+	OSM2MIFRunCounts()
+	{
+		m_nLines = m_nNodes = m_nNodesSkipped = m_nWays = m_nWaysSkipped = m_nWaysWritten = 0;
+		m_nNodesWritten = m_nNodesSimplifiedAway = 0;
+		m_nMultipolygons = m_nMultipolygonsWritten = m_nOpenRings = m_nOrphanInnerRings = m_nMemberWaysInMultipolygons = 0;
+		m_nWaysWithRestrictions = m_nRestrictionsFound = m_nRestrictionsWritten = 0;
+		m_nNodesInOtherShards = m_nWaysInOtherShards = m_nMultipolygonsInOtherShards = 0;
+		m_nBytesRead = 0;
+	}
+	int m_nLines, m_nNodes, m_nNodesSkipped, m_nWays, m_nWaysSkipped, m_nWaysWritten;
+	long m_nNodesWritten, m_nNodesSimplifiedAway;
+	int m_nMultipolygons, m_nMultipolygonsWritten, m_nOpenRings, m_nOrphanInnerRings;
+	int m_nMemberWaysInMultipolygons;	// ways only written as part of a multipolygon, as they have its values
+	int m_nWaysWithRestrictions, m_nRestrictionsFound, m_nRestrictionsWritten;
+	int m_nNodesInOtherShards, m_nWaysInOtherShards, m_nMultipolygonsInOtherShards;
+	long long m_nBytesRead;
+};
+
+class OSM2MIFConverter
+{
+public:
+	OSM2MIFConverter(OSM2MIFConfig& config) : m_config(config) {}
+
+	// Convert the whole input, passing every record to the sink.  Returns false (with strError set) if the input could not be
+	// read or parsed, or the sink failed.
+	// m_counts and m_stats are reset at the start of each conversion.
+	bool Convert(OSMInputSource& source, OSM2MIFSink& sink, std::string& strError);
+
+	OSM2MIFRunCounts m_counts;
+	RunStatistics m_stats;		// phase times, plus input/throughput/container values
+
+private:
+	OSM2MIFConfig& m_config;
+};
+
+class MidMifRecordWriter;
+
+// Writes the records to a pair of mid/mif files, optionally in Hilbert curve order of their centres
+class MidMifFileSink : public OSM2MIFSink
+{
+public:
+	MidMifFileSink(const std::string& strOutFile);
+	~MidMifFileSink();
+
+	void EnableHilbertSort(size_t nMaxBufferBytes);
+
+	bool Begin(const std::vector<OSM2MIFColumn>& columns, bool fHasRestrictions, std::string& strError);
+	bool Record(const OSM2MIFRecord& record, std::string& strError);
+	bool End(std::string& strError);
+
+	std::string MidFileName() { return m_strOutFile + ".mid"; }
+	std::string MifFileName() { return m_strOutFile + ".mif"; }
+	long long MidBytesWritten() { return m_nMidBytesWritten; }
+	long long MifBytesWritten() { return m_nMifBytesWritten; }
+	int SortRunsSpilled();
+
+private:
+	std::string m_strOutFile;
+	std::ofstream m_outMid, m_outMif;
+	MidMifRecordWriter* m_pWriter;
+	bool m_fHilbertSort, m_fHasRestrictions;
+	size_t m_nSortBufferBytes;
+	long m_nRecords;
+	long long m_nMidBytesWritten, m_nMifBytesWritten;
+	std::string m_strRestrictions;
+};
+
+// Sharded conversion, in three steps that can run on different machines (see scripts/osm2mif_shards.sh):
+//   PlanShards() reads the input (the ways twice if there are banned turns) and splits the nodes inside the bounding box into
+//     nShards strips of longitude with about the same number of nodes each.  It also works out each strip's halo from the extent of the ways and multipolygons it will
+//     own (only those the config's rules pass through) and the node after the junction of each banned turn on those ways.
+//   Each worker runs an OSM2MIFConverter with m_pShardPlan/m_nShard set.  Every worker still reads all the ways, so the
+//     intersections are the same as in a single conversion and ways are broken up at the same nodes, but it only keeps the
+//     nodes in its halo, the ways through them and the m_outside_way_ids its multipolygons' rings need.  Together the shards
+//     write the same records as a single conversion.
+//   MergeShards() appends the shards' mid/mif files into one pair.  Each shard is in its own order (e.g. Hilbert order), one
+//     strip after another.
+bool PlanShards(OSMInputSource& source, OSM2MIFConfig& config, int nShards, OSM2MIFShardPlan& plan, std::string& strError);
+std::string ShardOutputFileName(const std::string& strOutFile, int nShard);
+bool MergeShards(const std::string& strOutFile, int nShards, std::string& strError);
+
+#endif
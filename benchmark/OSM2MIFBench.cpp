@@ -0,0 +1,453 @@
+// OSM2MIF benchmark suite
+//
+// Generates a deterministic synthetic OSM file (see SyntheticOSM.h), runs the whole conversion on it, then times the main
+// building blocks of the converter on data taken from the same file.  Results are printed and written as JSON, so runs can be
+// compared to track regressions.
+//
+// Usage: OSM2MIFBench [-nodes N] [-ways N] [-tags N] [-restrictions per_way] [-sparsity N] [-seed N] [-repeat N]
+//                     [-work_dir dir] [-json results_file] [-hilbert_sort] [-compress_nodes]
+//
+// Building: OSM2MIFBench.vcproj, or e.g. g++ -O2 -o OSM2MIFBench OSM2MIFBench.cpp SyntheticOSM.cpp ../OSM2MIFLib.cpp
+
+#include "../OSM2MIFLib.h"
+#include "SyntheticOSM.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+
+class BenchTimer
+{
+public:
+	BenchTimer() { m_start = chrono::steady_clock::now(); }
+	double Seconds() { return chrono::duration<double>(chrono::steady_clock::now() - m_start).count(); }
+private:
+	chrono::steady_clock::time_point m_start;
+};
+
+// The result of one benchmark: the best (shortest) of its repeats
+class BenchResult
+{
+public:
+	BenchResult(const string& strName, const string& strItemName)
+	{
+		m_strName = strName;
+		m_strItemName = strItemName;
+		m_dblSeconds = 0;
+		m_nItems = 0;
+		m_nBytes = 0;
+		m_nMemoryBytes = 0;
+		m_nRepeats = 0;
+	}
+	void AddRepeat(double dblSeconds)
+	{
+		if (m_nRepeats == 0 || dblSeconds < m_dblSeconds)
+			m_dblSeconds = dblSeconds;
+		m_nRepeats++;
+	}
+	double ItemsPerSecond() { return m_dblSeconds > 0 ? m_nItems / m_dblSeconds : 0; }
+	double MBPerSecond() { return m_dblSeconds > 0 ? m_nBytes / m_dblSeconds / (1024 * 1024) : 0; }
+
+	string m_strName, m_strItemName;
+	double m_dblSeconds;
+	long long m_nItems, m_nBytes;
+	long long m_nMemoryBytes;	// for the benchmarks of data structures, the memory they use
+	int m_nRepeats;
+};
+
+// Keeps the optimiser from throwing away results the benchmarks don't otherwise use
+static volatile long s_nSink;
+
+void PrintResult(BenchResult& result)
+{
+	printf("%-28s %10.4f s  %14.0f %s/s", result.m_strName.c_str(), result.m_dblSeconds, result.ItemsPerSecond(), result.m_strItemName.c_str());
+	if (result.m_nBytes > 0)
+		printf("  %8.1f MB/s", result.MBPerSecond());
+	if (result.m_nMemoryBytes > 0)
+		printf("  %8.1f MB in memory", result.m_nMemoryBytes / (1024.0 * 1024.0));
+	printf("\n");
+}
+
+// Read the whole synthetic file line by line
+BenchResult BenchGetLineFromFile(const string& strOsmFile, int nRepeats)
+{
+	BenchResult result("GetLineFromFile", "lines");
+	for (int r = 0; r < nRepeats; r++)
+	{
+		ifstream in(strOsmFile.c_str());
+		long long nLines = 0, nBytes = 0;
+		char* s;
+		BenchTimer timer;
+		while (GetLineFromFile(in, s))
+		{
+			nLines++;
+			nBytes += strlen(s) + 1;
+		}
+		result.AddRepeat(timer.Seconds());
+		result.m_nItems = nLines;
+		result.m_nBytes = nBytes;
+	}
+	return result;
+}
+
+BenchResult BenchConvertTextTolong(vector<string>& ids, int nRepeats)
+{
+	BenchResult result("ConvertTextTolong", "ids");
+	for (int r = 0; r < nRepeats; r++)
+	{
+		long nTotal = 0, lValue;
+		BenchTimer timer;
+		for (vector<string>::iterator it = ids.begin(); it != ids.end(); it++)
+			if (ConvertTextTolong(it->c_str(), lValue))
+				nTotal += lValue;
+		result.AddRepeat(timer.Seconds());
+		s_nSink = nTotal;
+	}
+	result.m_nItems = ids.size();
+	return result;
+}
+
+BenchResult BenchConvertTextToDouble(vector<string>& coordinates, int nRepeats)
+{
+	BenchResult result("ConvertTextToDouble", "coordinates");
+	for (int r = 0; r < nRepeats; r++)
+	{
+		double dblTotal = 0, dblValue;
+		BenchTimer timer;
+		for (vector<string>::iterator it = coordinates.begin(); it != coordinates.end(); it++)
+			if (ConvertTextToDouble(it->c_str(), dblValue))
+				dblTotal += dblValue;
+		result.AddRepeat(timer.Seconds());
+		s_nSink = (long)dblTotal;
+	}
+	result.m_nItems = coordinates.size();
+	return result;
+}
+
+BenchResult BenchReadKeyValuePairsForWay(vector<vector<char> >& way_lines, map<string, ParameterValues*>& mapIncludedValues,
+										 map<string, ParameterValues*>& mapExcludedValues, int nRepeats)
+{
+	BenchResult result("ReadKeyValuePairsForWay", "lines");
+	vector<string> values_in_current_way(mapIncludedValues.size());
+	string strMifTypeForThisWay, strStyleForThisWay;
+	for (int r = 0; r < nRepeats; r++)
+	{
+		long nIncluded = 0;
+		BenchTimer timer;
+		for (vector<vector<char> >::iterator it = way_lines.begin(); it != way_lines.end(); it++)
+		{
+			char* s = &(*it)[0];
+			bool fBreakUpThisWay, fSkipThisWay = false, fFoundAtLeastOneIncludedValueInThisWay = false;
+			int nNumberOfMandatoryKeysFoundForThisWay = 0;
+			double dblSimplifyToleranceForThisWay = 0;
+			ReadKeyValuePairsForWay(s, mapIncludedValues, mapExcludedValues, values_in_current_way, strMifTypeForThisWay, strStyleForThisWay,
+									fBreakUpThisWay, fSkipThisWay, fFoundAtLeastOneIncludedValueInThisWay, nNumberOfMandatoryKeysFoundForThisWay,
+									dblSimplifyToleranceForThisWay);
+			if (fFoundAtLeastOneIncludedValueInThisWay)
+				nIncluded++;
+		}
+		result.AddRepeat(timer.Seconds());
+		s_nSink = nIncluded;
+	}
+	result.m_nItems = way_lines.size();
+	return result;
+}
+
+// Restriction lookups at synthetic right-angled junctions: 'from' way i runs east into node 3i+1, 'to' way runs north from it
+BenchResult BenchGetRelationData(long nJunctions, int nRepeats)
+{
+	BenchResult result("GetRelationData", "lookups");
+
+	map<long, vector<long> > nodes_in_each_way;
+	NodeStore nodes;
+	multimap<long, Relation*> relations;
+	vector<Relation*> all_relations;
+	for (long i = 0; i < nJunctions; i++)
+	{
+		long from_way = 2 * i, to_way = 2 * i + 1, node = 3 * i;
+		nodes_in_each_way[from_way].push_back(node);
+		nodes_in_each_way[from_way].push_back(node + 1);
+		nodes_in_each_way[to_way].push_back(node + 1);
+		nodes_in_each_way[to_way].push_back(node + 2);
+		nodes.Add(node, 51.0, 0.0 + i * 0.001);
+		nodes.Add(node + 1, 51.0, 0.0005 + i * 0.001);
+		nodes.Add(node + 2, 51.0005, 0.0005 + i * 0.001);
+
+		Relation* relation = new Relation;
+		relation->m_from_way_ids.push_back(from_way);
+		relation->m_node_via_id = node + 1;
+		relation->m_to_way_id = to_way;
+		relation->m_fIsRestriction = true;
+		relations.insert(pair<long, Relation*>(from_way, relation));
+		all_relations.push_back(relation);
+	}
+
+	for (int r = 0; r < nRepeats; r++)
+	{
+		int nRelationsWritten = 0, nRelationsFound = 0;
+		long nLength = 0;
+		BenchTimer timer;
+		for (long i = 0; i < nJunctions; i++)
+		{
+			RelationsItPair itRelations = relations.equal_range(2 * i);
+			nLength += GetRelationData(itRelations, nodes_in_each_way, 2 * i, 1, nodes, nRelationsWritten, nRelationsFound, false).length();
+		}
+		result.AddRepeat(timer.Seconds());
+		s_nSink = nLength + nRelationsWritten;
+	}
+	result.m_nItems = nJunctions;
+
+	for (vector<Relation*>::iterator it = all_relations.begin(); it != all_relations.end(); it++)
+		delete *it;
+	return result;
+}
+
+// Look up the nodes of every way, in way order as the emission pass does, in a node store holding all the nodes
+BenchResult BenchNodeStore(vector<pair<long, pair<double,double> > >& node_locations, vector<long>& way_node_ids, bool fCompress, int nRepeats)
+{
+	BenchResult result(fCompress ? "NodeStore compressed" : "NodeStore", "lookups");
+
+	NodeStore nodes(fCompress);
+	for (vector<pair<long, pair<double,double> > >::iterator it = node_locations.begin(); it != node_locations.end(); it++)
+		nodes.Add(it->first, it->second.first, it->second.second);
+
+	for (int r = 0; r < nRepeats; r++)
+	{
+		double dblTotal = 0;
+		pair<double,double> latlon;
+		BenchTimer timer;
+		for (vector<long>::iterator it = way_node_ids.begin(); it != way_node_ids.end(); it++)
+			if (nodes.Find(*it, latlon))
+				dblTotal += latlon.first;
+		result.AddRepeat(timer.Seconds());
+		s_nSink = (long)dblTotal;
+	}
+	result.m_nItems = way_node_ids.size();
+	result.m_nMemoryBytes = nodes.MemoryBytes();
+	return result;
+}
+
+BenchResult BenchWriteMidMifRecord(const string& strOutFile, long nRecords, int nRepeats)
+{
+	BenchResult result("WriteMidMifRecord", "records");
+
+	vector<pair<double,double> > latlons;
+	for (int i = 0; i < 8; i++)
+		latlons.push_back(pair<double,double>(51.1234567 + i * 0.0001, -0.1234567 + i * 0.0002));
+	// the columns of the synthetic parameters file: highway, id, maxspeed, name, oneway
+	vector<string> values;
+	values.push_back("residential");
+	values.push_back("123456789");
+	values.push_back("30");
+	values.push_back("Mill &amp; Station Road");
+	values.push_back("1");
+
+	for (int r = 0; r < nRepeats; r++)
+	{
+		ofstream outMid((strOutFile + ".mid").c_str(), ios::trunc), outMif((strOutFile + ".mif").c_str(), ios::trunc);
+		BenchTimer timer;
+		for (long i = 0; i < nRecords; i++)
+			WriteMidMifRecord(outMid, outMif, "Pline", "Pen (2,54,32768)", latlons, OSM2MIFSpan<string>(values), true, "\"\"");
+		outMid.flush();
+		outMif.flush();
+		result.AddRepeat(timer.Seconds());
+		result.m_nBytes = (long long)outMid.tellp() + (long long)outMif.tellp();
+	}
+	result.m_nItems = nRecords;
+	remove((strOutFile + ".mid").c_str());
+	remove((strOutFile + ".mif").c_str());
+	return result;
+}
+
+void WriteJsonResult(FILE* out, BenchResult& result, bool fLast)
+{
+	fprintf(out, "    {\"name\": \"%s\", \"seconds\": %.6f, \"repeats\": %d, \"items\": %lld, \"item\": \"%s\", \"items_per_second\": %.1f",
+			result.m_strName.c_str(), result.m_dblSeconds, result.m_nRepeats, result.m_nItems, result.m_strItemName.c_str(), result.ItemsPerSecond());
+	if (result.m_nBytes > 0)
+		fprintf(out, ", \"bytes\": %lld, \"mb_per_second\": %.3f", result.m_nBytes, result.MBPerSecond());
+	if (result.m_nMemoryBytes > 0)
+		fprintf(out, ", \"memory_bytes\": %lld", result.m_nMemoryBytes);
+	fprintf(out, "}%s\n", fLast ? "" : ",");
+}
+
+int main(int argc, char* argv[])
+{
+	SyntheticOSMSettings settings;
+	int nRepeats = 3;
+	string strWorkDir = ".", strJsonFile = "OSM2MIFBench.json";
+	bool fHilbertSort = false, fCompressNodes = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string strOption = argv[i];
+		if (strOption == "-hilbert_sort")
+		{
+			fHilbertSort = true;
+			continue;
+		}
+		if (strOption == "-compress_nodes")
+		{
+			fCompressNodes = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			cout << "Option " << strOption << " needs a value" << endl;
+			return 1;
+		}
+		string strValue = argv[++i];
+		if (strOption == "-nodes")
+			settings.m_nNodes = atol(strValue.c_str());
+		else if (strOption == "-ways")
+			settings.m_nWays = atol(strValue.c_str());
+		else if (strOption == "-tags")
+			settings.m_nTagsPerWay = atoi(strValue.c_str());
+		else if (strOption == "-restrictions")
+			settings.m_dblRestrictionsPerWay = atof(strValue.c_str());
+		else if (strOption == "-sparsity")
+			settings.m_nIdSparsity = atoi(strValue.c_str());
+		else if (strOption == "-seed")
+			settings.m_nSeed = strtoull(strValue.c_str(), NULL, 10);
+		else if (strOption == "-repeat")
+			nRepeats = max(1, atoi(strValue.c_str()));
+		else if (strOption == "-work_dir")
+			strWorkDir = strValue;
+		else if (strOption == "-json")
+			strJsonFile = strValue;
+		else
+		{
+			cout << "Unrecognised option " << strOption << endl;
+			return 1;
+		}
+	}
+
+	string strOsmFile = strWorkDir + "/bench_input.osm", strParametersFile = strWorkDir + "/bench_parameters.txt";
+	string strOutFile = strWorkDir + "/bench_output";
+	string strError;
+
+	printf("Generating %ld nodes, %ld ways (%d tags each, %.3f restrictions per way, id sparsity %d, seed %llu)\n",
+		   settings.m_nNodes, settings.m_nWays, settings.m_nTagsPerWay, settings.m_dblRestrictionsPerWay, settings.m_nIdSparsity, settings.m_nSeed);
+	SyntheticOSMCounts counts;
+	BenchTimer generate_timer;
+	if (!GenerateSyntheticOSM(strOsmFile, settings, counts, strError) || !WriteSyntheticParametersFile(strParametersFile, strError))
+	{
+		cout << strError << endl;
+		return 1;
+	}
+	printf("Generated %.1f MB in %.2f s\n", counts.m_nBytes / (1024.0 * 1024.0), generate_timer.Seconds());
+
+	// End to end first, while the process is still small, so the peak RSS is that of the conversion
+	OSM2MIFConfig config;
+	if (!config.ReadParametersFile(strParametersFile, strError))
+	{
+		cout << "Error in Parameters File: " << strError << endl;
+		return 1;
+	}
+	config.m_fCompressNodes = fCompressNodes;
+
+	BenchTimer end_to_end_timer;
+	{
+		OSMFileSource source(strOsmFile);
+		MidMifFileSink sink(strOutFile);
+		if (fHilbertSort)
+			sink.EnableHilbertSort(256 * 1024 * 1024);
+		OSM2MIFConverter converter(config);
+		if (!converter.Convert(source, sink, strError))
+		{
+			cout << strError << endl;
+			return 1;
+		}
+		printf("Converted: %d ways written, %ld nodes written\n", converter.m_counts.m_nWaysWritten, converter.m_counts.m_nNodesWritten);
+		converter.m_stats.PrintPhases();
+	}
+	double dblEndToEndSeconds = end_to_end_timer.Seconds();
+	long nEndToEndPeakRSS = GetPeakRSSKilobytes();
+
+	// data for the micro-benchmarks, taken from the generated file
+	vector<string> ids, coordinates;
+	vector<vector<char> > way_lines;
+	vector<pair<long, pair<double,double> > > node_locations;
+	vector<long> way_node_ids;
+	{
+		ifstream in(strOsmFile.c_str());
+		char* s;
+		while (GetLineFromFile(in, s))
+		{
+			char* p;
+			if ((p = strstr(s, "<node id=\"")) != NULL)
+			{
+				ids.push_back(p + 10);
+				long id;
+				double lat = 0, lon = 0;
+				ConvertTextTolong(p + 10, id);
+				if ((p = strstr(s, "lat=\"")) != NULL && ConvertTextToDouble(p + 5, lat))
+					coordinates.push_back(p + 5);
+				if ((p = strstr(s, "lon=\"")) != NULL && ConvertTextToDouble(p + 5, lon))
+					coordinates.push_back(p + 5);
+				node_locations.push_back(make_pair(id, make_pair(lat, lon)));
+			}
+			else if (strstr(s, "<relation") != NULL)
+				break;
+			else
+			{
+				long id;
+				if ((p = strstr(s, "<nd ref=\"")) != NULL)
+				{
+					ids.push_back(p + 9);
+					if (ConvertTextTolong(p + 9, id))
+						way_node_ids.push_back(id);
+				}
+				way_lines.push_back(vector<char>(s, s + strlen(s) + 1));
+			}
+		}
+	}
+
+	vector<BenchResult> results;
+	results.push_back(BenchGetLineFromFile(strOsmFile, nRepeats));
+	results.push_back(BenchConvertTextTolong(ids, nRepeats));
+	results.push_back(BenchConvertTextToDouble(coordinates, nRepeats));
+	results.push_back(BenchReadKeyValuePairsForWay(way_lines, config.m_mapIncludedValues, config.m_mapExcludedValues, nRepeats));
+	results.push_back(BenchNodeStore(node_locations, way_node_ids, false, nRepeats));
+	results.push_back(BenchNodeStore(node_locations, way_node_ids, true, nRepeats));
+	results.push_back(BenchGetRelationData(max(1000L, settings.m_nWays / 10), nRepeats));
+	results.push_back(BenchWriteMidMifRecord(strWorkDir + "/bench_records", max(1000L, settings.m_nWays), nRepeats));
+
+	printf("\n");
+	for (vector<BenchResult>::iterator it = results.begin(); it != results.end(); it++)
+		PrintResult(*it);
+
+	double dblMBPerSecond = counts.m_nBytes / dblEndToEndSeconds / (1024 * 1024);
+	printf("%-28s %10.4f s  %8.1f MB/s  %12.0f nodes/s  %10.0f ways/s  peak RSS %ld KB\n", "end to end", dblEndToEndSeconds,
+		   dblMBPerSecond, counts.m_nNodes / dblEndToEndSeconds, counts.m_nWays / dblEndToEndSeconds, nEndToEndPeakRSS);
+
+	FILE* out = fopen(strJsonFile.c_str(), "w");
+	if (out == NULL)
+	{
+		cout << "Could not open " << strJsonFile << " for writing" << endl;
+		return 1;
+	}
+	fprintf(out, "{\n");
+	fprintf(out, "  \"settings\": {\"nodes\": %ld, \"ways\": %ld, \"tags_per_way\": %d, \"restrictions_per_way\": %.4f, \"id_sparsity\": %d, \"seed\": %llu, "
+			"\"repeats\": %d, \"hilbert_sort\": %s, \"compress_nodes\": %s},\n", settings.m_nNodes, settings.m_nWays, settings.m_nTagsPerWay, 
+			settings.m_dblRestrictionsPerWay, settings.m_nIdSparsity, settings.m_nSeed, nRepeats, fHilbertSort ? "true" : "false", 
+			fCompressNodes ? "true" : "false");
+	fprintf(out, "  \"input\": {\"bytes\": %lld, \"nodes\": %ld, \"ways\": %ld, \"way_nodes\": %ld, \"tags\": %ld, \"restrictions\": %ld},\n",
+			counts.m_nBytes, counts.m_nNodes, counts.m_nWays, counts.m_nWayNodes, counts.m_nTags, counts.m_nRestrictions);
+	fprintf(out, "  \"end_to_end\": {\"seconds\": %.6f, \"mb_per_second\": %.3f, \"nodes_per_second\": %.1f, \"ways_per_second\": %.1f, \"peak_rss_kb\": %ld},\n",
+			dblEndToEndSeconds, dblMBPerSecond, counts.m_nNodes / dblEndToEndSeconds, counts.m_nWays / dblEndToEndSeconds, nEndToEndPeakRSS);
+	fprintf(out, "  \"micro\": [\n");
+	for (int i = 0; i < (int)results.size(); i++)
+		WriteJsonResult(out, results[i], i == (int)results.size() - 1);
+	fprintf(out, "  ],\n");
+	fprintf(out, "  \"peak_rss_kb\": %ld\n", GetPeakRSSKilobytes());
+	fprintf(out, "}\n");
+	fclose(out);
+
+	printf("\nResults written to %s\n", strJsonFile.c_str());
+	return 0;
+}
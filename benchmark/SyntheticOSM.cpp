@@ -0,0 +1,194 @@
+#include "SyntheticOSM.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+
+static const char* s_szHighwayValues[] = { "residential", "residential", "residential", "unclassified", "tertiary", "secondary", "primary", "service" };
+static const char* s_szSurfaceValues[] = { "asphalt", "paved", "gravel", "unpaved" };
+
+// Write one extra tag for a way; which tag is picked by 'n' so every way gets the same set of keys in the same order
+static int WriteExtraTag(FILE* out, int n, long way_index, SyntheticRandom& random)
+{
+	switch (n % 5)
+	{
+	case 0:
+		// every so often use an ampersand, so the escaping in the mid output is exercised
+		if (way_index % 50 == 0)
+			return fprintf(out, "  <tag k=\"name\" v=\"Mill &amp; Station Road %ld\"/>\n", way_index);
+		return fprintf(out, "  <tag k=\"name\" v=\"Street %ld\"/>\n", way_index);
+	case 1:
+		return fprintf(out, "  <tag k=\"maxspeed\" v=\"%ld\"/>\n", 20 + 10 * random.Below(8));
+	case 2:
+		return fprintf(out, "  <tag k=\"oneway\" v=\"%s\"/>\n", random.Below(4) == 0 ? "yes" : "no");
+	case 3:
+		return fprintf(out, "  <tag k=\"surface\" v=\"%s\"/>\n", s_szSurfaceValues[random.Below(4)]);
+	default:
+		return fprintf(out, "  <tag k=\"lanes\" v=\"%ld\"/>\n", 1 + random.Below(4));
+	}
+}
+
+bool GenerateSyntheticOSM(const string& strFile, const SyntheticOSMSettings& settings, SyntheticOSMCounts& counts, string& strError)
+{
+	if (settings.m_nNodes < 4 || settings.m_nWays < 1 || settings.m_nMinNodesPerWay < 2 || settings.m_nMaxNodesPerWay < settings.m_nMinNodesPerWay
+		|| settings.m_nIdSparsity < 1)
+	{
+		strError = "Invalid synthetic OSM settings";
+		return false;
+	}
+
+	FILE* out = fopen(strFile.c_str(), "wb");
+	if (out == NULL)
+	{
+		strError = "Could not open " + strFile + " for writing";
+		return false;
+	}
+
+	SyntheticRandom random(settings.m_nSeed);
+	counts = SyntheticOSMCounts();
+
+	long long nBytes = fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\" generator=\"OSM2MIFBench\">\n");
+
+	// nodes: a jittered grid, numbered row by row
+	long nColumns = (long)sqrt((double)settings.m_nNodes);
+	long nRows = (settings.m_nNodes + nColumns - 1) / nColumns;
+	double dblCellLon = (settings.m_max_lon - settings.m_min_lon) / nColumns, dblCellLat = (settings.m_max_lat - settings.m_min_lat) / nRows;
+
+	vector<long> node_ids(settings.m_nNodes);
+	long id = 0;
+	for (long i = 0; i < settings.m_nNodes; i++)
+	{
+		id += 1 + (settings.m_nIdSparsity > 1 ? random.Below(settings.m_nIdSparsity) : 0);
+		node_ids[i] = id;
+
+		double lon = settings.m_min_lon + ((i % nColumns) + 0.2 + 0.6 * random.Unit()) * dblCellLon;
+		double lat = settings.m_min_lat + ((i / nColumns) + 0.2 + 0.6 * random.Unit()) * dblCellLat;
+		nBytes += fprintf(out, " <node id=\"%ld\" version=\"1\" lat=\"%.7f\" lon=\"%.7f\"/>\n", id, lat, lon);
+	}
+	counts.m_nNodes = settings.m_nNodes;
+
+	// ways: random walks between neighbouring grid nodes.  Remember which way last used each node, so that junctions
+	// between two ways can be picked for restrictions afterwards.
+	vector<long> last_way_of_node(settings.m_nNodes, -1);
+	vector<long> way_ids(settings.m_nWays);
+	vector<long> junction_from_way, junction_node, junction_to_way;
+	vector<long> walk;
+
+	id = 0;
+	for (long w = 0; w < settings.m_nWays; w++)
+	{
+		id += 1 + (settings.m_nIdSparsity > 1 ? random.Below(settings.m_nIdSparsity) : 0);
+		way_ids[w] = id;
+
+		int nNodesInWay = settings.m_nMinNodesPerWay + random.Below(settings.m_nMaxNodesPerWay - settings.m_nMinNodesPerWay + 1);
+		long node = random.Below(settings.m_nNodes);
+		walk.clear();
+		walk.push_back(node);
+		for (int n = 1; n < nNodesInWay; n++)
+		{
+			// step to a neighbouring grid node, preferring to keep going forwards
+			long next;
+			switch (random.Below(4))
+			{
+			case 0:  next = node + 1; break;
+			case 1:  next = node + nColumns; break;
+			case 2:  next = (random.Below(2) == 0 ? node - 1 : node + 1); break;
+			default: next = (random.Below(2) == 0 ? node - nColumns : node + nColumns); break;
+			}
+			// an east/west step off the end of a row would wrap to the other side of the grid
+			if (next < 0 || next >= settings.m_nNodes || next == walk.back() || ((next - node == 1 || node - next == 1) && next / nColumns != node / nColumns))
+				break;
+			node = next;
+			walk.push_back(node);
+		}
+		if (walk.size() < 2)
+		{
+			long first = walk[0];
+			if (first % nColumns > 0)
+				walk.push_back(first - 1);
+			else if (first + 1 < settings.m_nNodes && nColumns > 1)
+				walk.push_back(first + 1);
+			else
+				walk.push_back(first + nColumns < settings.m_nNodes ? first + nColumns : first - nColumns);
+		}
+
+		nBytes += fprintf(out, " <way id=\"%ld\" version=\"1\">\n", id);
+		for (int n = 0; n < (int)walk.size(); n++)
+		{
+			nBytes += fprintf(out, "  <nd ref=\"%ld\"/>\n", node_ids[walk[n]]);
+
+			// a junction is only a usable restriction if the 'from' way has a node before the via node
+			long other = last_way_of_node[walk[n]];
+			if (other >= 0 && other != w && n > 0)
+			{
+				junction_from_way.push_back(w);
+				junction_node.push_back(walk[n]);
+				junction_to_way.push_back(other);
+			}
+			last_way_of_node[walk[n]] = w;
+		}
+		counts.m_nWayNodes += walk.size();
+
+		nBytes += fprintf(out, "  <tag k=\"highway\" v=\"%s\"/>\n", s_szHighwayValues[random.Below(8)]);
+		for (int t = 1; t < settings.m_nTagsPerWay; t++)
+			nBytes += WriteExtraTag(out, t - 1, w, random);
+		counts.m_nTags += settings.m_nTagsPerWay;
+		nBytes += fprintf(out, " </way>\n");
+	}
+	counts.m_nWays = settings.m_nWays;
+
+	// restriction relations at a random selection of the junctions
+	long nRestrictions = (long)(settings.m_dblRestrictionsPerWay * settings.m_nWays);
+	if (nRestrictions > (long)junction_node.size())
+		nRestrictions = (long)junction_node.size();
+	long relation_id = 0;
+	for (long r = 0; r < nRestrictions; r++)
+	{
+		long j = random.Below((long)junction_node.size());
+		relation_id += 1 + (settings.m_nIdSparsity > 1 ? random.Below(settings.m_nIdSparsity) : 0);
+		nBytes += fprintf(out, " <relation id=\"%ld\" version=\"1\">\n", relation_id);
+		nBytes += fprintf(out, "  <member type=\"way\" ref=\"%ld\" role=\"from\"/>\n", way_ids[junction_from_way[j]]);
+		nBytes += fprintf(out, "  <member type=\"node\" ref=\"%ld\" role=\"via\"/>\n", node_ids[junction_node[j]]);
+		nBytes += fprintf(out, "  <member type=\"way\" ref=\"%ld\" role=\"to\"/>\n", way_ids[junction_to_way[j]]);
+		nBytes += fprintf(out, "  <tag k=\"restriction\" v=\"no_right_turn\"/>\n");
+		nBytes += fprintf(out, "  <tag k=\"type\" v=\"restriction\"/>\n");
+		nBytes += fprintf(out, " </relation>\n");
+	}
+	counts.m_nRestrictions = nRestrictions;
+
+	nBytes += fprintf(out, "</osm>\n");
+	counts.m_nBytes = nBytes;
+
+	bool fOK = (ferror(out) == 0);
+	fclose(out);
+	if (!fOK)
+		strError = "Could not write to " + strFile;
+	return fOK;
+}
+
+bool WriteSyntheticParametersFile(const string& strFile, string& strError)
+{
+	FILE* out = fopen(strFile.c_str(), "wb");
+	if (out == NULL)
+	{
+		strError = "Could not open " + strFile + " for writing";
+		return false;
+	}
+
+	fprintf(out, "// Parameters for the OSM2MIF benchmark's synthetic input\n");
+	fprintf(out, "mk=\"highway\" iv=\"*\" iv=\"primary\" style=\"Pen (3,2,16711680)\" iv=\"secondary\" style=\"Pen (2,2,16744448)\" ev=\"service\"\n");
+	fprintf(out, "k=\"id\" iv=\"*\" type=\"Integer\"\n");
+	fprintf(out, "k=\"name\" iv=\"*\" type=\"Char(100)\"\n");
+	fprintf(out, "k=\"oneway\" iv=\"yes\" tv=\"1\" iv=\"no\" tv=\"0\" type=\"Integer\"\n");
+	fprintf(out, "k=\"maxspeed\" iv=\"*\" type=\"Integer\"\n");
+	fprintf(out, "k=\"surface\" ev=\"unpaved\"\n");
+
+	bool fOK = (ferror(out) == 0);
+	fclose(out);
+	if (!fOK)
+		strError = "Could not write to " + strFile;
+	return fOK;
+}
@@ -0,0 +1,84 @@
+#ifndef SYNTHETIC_OSM_H
+#define SYNTHETIC_OSM_H
+
+#include <string>
+
+
+// Settings for the synthetic OSM generator.  The same settings (including the seed) always give a byte-identical file.
+class SyntheticOSMSettings
+{
+public:
+	SyntheticOSMSettings()
+	{
+		m_nNodes = 1000000;
+		m_nWays = 150000;
+		m_nMinNodesPerWay = 2;
+		m_nMaxNodesPerWay = 12;
+		m_nTagsPerWay = 3;
+		m_dblRestrictionsPerWay = 0.02;
+		m_nIdSparsity = 1;
+		m_nSeed = 1;
+		m_min_lon = -2.0;
+		m_max_lon = 2.0;
+		m_min_lat = 50.0;
+		m_max_lat = 53.0;
+	}
+	long m_nNodes, m_nWays;
+	int m_nMinNodesPerWay, m_nMaxNodesPerWay;
+	int m_nTagsPerWay;				// tags on each way, including the highway tag
+	double m_dblRestrictionsPerWay;	// restriction relations generated per way (where there are enough junctions)
+	int m_nIdSparsity;				// node/way ids go up in random steps of 1..m_nIdSparsity (1 = consecutive ids)
+	unsigned long long m_nSeed;
+	double m_min_lon, m_max_lon, m_min_lat, m_max_lat;
+};
+
+// What was actually generated
+class SyntheticOSMCounts
+{
+public:
+	SyntheticOSMCounts()
+	{
+		m_nNodes = m_nWays = m_nWayNodes = m_nTags = m_nRestrictions = m_nBytes = 0;
+	}
+	long m_nNodes, m_nWays, m_nWayNodes, m_nTags, m_nRestrictions;
+	long long m_nBytes;
+};
+
+// Small, fast, platform independent random number generator (xorshift64*), so generated files are the same everywhere
+class SyntheticRandom
+{
+public:
+	SyntheticRandom(unsigned long long nSeed)
+	{
+		m_nState = nSeed * 0x9E3779B97F4A7C15ULL + 1;
+	}
+	unsigned long long Next()
+	{
+		m_nState ^= m_nState >> 12;
+		m_nState ^= m_nState << 25;
+		m_nState ^= m_nState >> 27;
+		return m_nState * 0x2545F4914F6CDD1DULL;
+	}
+	// integer in [0, n)
+	long Below(long n)
+	{
+		return (long)(Next() % (unsigned long long)n);
+	}
+	// real in [0, 1)
+	double Unit()
+	{
+		return (Next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+private:
+	unsigned long long m_nState;
+};
+
+// Write an OSM XML file of nodes laid out on a jittered grid (so nearby ids are nearby in space, as in real extracts), highway ways
+// that random-walk across the grid and so cross each other at shared nodes, and 'no_right_turn' restriction relations at some of
+// those junctions.  Elements are written one per line in the layout OSM2MIF reads.
+bool GenerateSyntheticOSM(const std::string& strFile, const SyntheticOSMSettings& settings, SyntheticOSMCounts& counts, std::string& strError);
+
+// Write a parameters file that passes all the generated highways through, with a few styled and typed columns
+bool WriteSyntheticParametersFile(const std::string& strFile, std::string& strError);
+
+#endif
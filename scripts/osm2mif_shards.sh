@@ -0,0 +1,48 @@
+#!/bin/sh
+# Sharded OSM2MIF conversion on one machine: plans the shards, runs one worker process per shard in parallel, then merges them.
+# Across several machines the steps are the same, by hand: run -plan once, copy the .plan file to each machine and run -shard n
+# there, then bring the .shard<n>.mid/.mif files back next to the .plan file and run -merge.
+#
+# Usage: osm2mif_shards.sh OSM2MIF_executable OSM_input_file Parameters_file MIF_output_file_name number_of_shards [worker options]
+#    e.g. osm2mif_shards.sh ./OSM2MIF england.osm parameters.txt england 8 -hilbert_sort
+
+if [ $# -lt 5 ]; then
+	echo "Usage: $0 OSM2MIF_executable OSM_input_file Parameters_file MIF_output_file_name number_of_shards [worker options]"
+	exit 1
+fi
+OSM2MIF=$1
+INPUT=$2
+PARAMETERS=$3
+OUTPUT=$4
+SHARDS=$5
+shift 5
+
+if ! "$OSM2MIF" "$INPUT" "$PARAMETERS" "$OUTPUT" -plan "$SHARDS" -no_pause -no_progress; then
+	echo "No shard plan was written"
+	exit 1
+fi
+
+PIDS=""
+i=0
+while [ $i -lt "$SHARDS" ]; do
+	"$OSM2MIF" "$INPUT" "$PARAMETERS" "$OUTPUT" -shard $i -no_pause -no_progress "$@" > "$OUTPUT.shard$i.log" 2>&1 &
+	PIDS="$PIDS $!"
+	i=$((i + 1))
+done
+
+# wait for each worker in turn, so a failure is seen in its exit status
+FAILED=0
+i=0
+for PID in $PIDS; do
+	if ! wait "$PID"; then
+		echo "Shard $i failed:"
+		cat "$OUTPUT.shard$i.log"
+		FAILED=1
+	fi
+	i=$((i + 1))
+done
+if [ $FAILED -ne 0 ]; then
+	exit 1
+fi
+
+"$OSM2MIF" "$INPUT" "$PARAMETERS" "$OUTPUT" -merge
@@ -0,0 +1,627 @@
+// OSM2MIF library tests
+//
+// Converts small OSM documents held in memory and checks the records the converter passes to its sink.  Prints each failed check
+// and exits with a non-zero status if there were any.
+//
+// Usage: OSM2MIFTest
+//
+// Building: OSM2MIFTest.vcproj, or e.g. g++ -O2 -o OSM2MIFTest OSM2MIFTest.cpp ../OSM2MIFLib.cpp
+
+#include "../OSM2MIFLib.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+
+int nChecks = 0, nFailures = 0;
+
+#define CHECK(condition) Check((condition), #condition, __LINE__)
+
+void Check(bool fCondition, const char* szCondition, int nLine)
+{
+	nChecks++;
+	if (!fCondition)
+	{
+		cout << "Line " << nLine << ": check failed: " << szCondition << endl;
+		nFailures++;
+	}
+}
+
+// Keeps a copy of every record, since the record itself is only valid during the Record() call
+class CollectingSink : public OSM2MIFSink
+{
+public:
+	class CollectedRecord
+	{
+	public:
+		bool m_fIsRegion;
+		vector<vector<pair<double,double> > > m_rings;
+		vector<string> m_values;
+		string m_strRestrictions;
+	};
+
+	bool Begin(const vector<OSM2MIFColumn>& columns, bool /*fHasRestrictions*/, string& /*strError*/)
+	{
+		m_columns = columns;
+		m_records.clear();
+		return true;
+	}
+
+	bool Record(const OSM2MIFRecord& record, string& /*strError*/)
+	{
+		m_records.push_back(CollectedRecord());
+		m_records.back().m_fIsRegion = record.m_fIsRegion;
+		m_records.back().m_rings.assign(record.m_rings.begin(), record.m_rings.end());
+		m_records.back().m_values.assign(record.m_values.begin(), record.m_values.end());
+		if (record.m_pRestrictions != NULL)
+			m_records.back().m_strRestrictions = *record.m_pRestrictions;
+		return true;
+	}
+
+	vector<OSM2MIFColumn> m_columns;
+	vector<CollectedRecord> m_records;
+};
+
+const char* szTwoWays =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<osm version=\"0.6\">\n"
+	" <node id=\"1\" lat=\"51.0\" lon=\"-1.0\"/>\n"
+	" <node id=\"2\" lat=\"51.0\" lon=\"-0.9\"/>\n"
+	" <node id=\"3\" lat=\"51.1\" lon=\"-0.9\"/>\n"
+	" <way id=\"10\">\n"
+	"  <nd ref=\"1\"/>\n"
+	"  <nd ref=\"2\"/>\n"
+	"  <tag k=\"highway\" v=\"primary\"/>\n"
+	"  <tag k=\"name\" v=\"High Street\"/>\n"
+	" </way>\n"
+	" <way id=\"11\">\n"
+	"  <nd ref=\"2\"/>\n"
+	"  <nd ref=\"3\"/>\n"
+	"  <tag k=\"highway\" v=\"residential\"/>\n"
+	" </way>\n"
+	" <way id=\"12\">\n"
+	"  <nd ref=\"1\"/>\n"
+	"  <nd ref=\"3\"/>\n"
+	"  <tag k=\"railway\" v=\"rail\"/>\n"
+	" </way>\n"
+	"</osm>\n";
+
+// A config built in code rather than read from a parameters file: any highway is mandatory, and its name is kept
+void TestProgrammaticConfig()
+{
+	OSM2MIFConfig config;
+	ParameterValues* highway = new ParameterValues(true);
+	highway->m_fIsAll = true;
+	config.m_mapIncludedValues["highway"] = highway;
+	ParameterValues* name = new ParameterValues;
+	name->m_fIsAll = true;
+	config.m_mapIncludedValues["name"] = name;
+	config.m_fProcessRelations = false;
+
+	OSMMemorySource source(szTwoWays, strlen(szTwoWays));
+	CollectingSink sink;
+	OSM2MIFConverter converter(config);
+	string strError;
+	CHECK(converter.Convert(source, sink, strError));
+	CHECK(strError.empty());
+
+	CHECK(sink.m_columns.size() == 2);
+	if (sink.m_columns.size() == 2)
+	{
+		CHECK(sink.m_columns[0].m_strName == "highway");
+		CHECK(sink.m_columns[1].m_strName == "name");
+	}
+
+	CHECK(sink.m_records.size() == 2);
+	if (sink.m_records.size() == 2)
+	{
+		CHECK(!sink.m_records[0].m_fIsRegion);
+		CHECK(sink.m_records[0].m_rings.size() == 1 && sink.m_records[0].m_rings[0].size() == 2);
+		CHECK(sink.m_records[0].m_values.size() == 2);
+		if (sink.m_records[0].m_values.size() == 2)
+		{
+			CHECK(sink.m_records[0].m_values[0] == "primary");
+			CHECK(sink.m_records[0].m_values[1] == "High Street");
+		}
+		CHECK(sink.m_records[1].m_values.size() == 2);
+		if (sink.m_records[1].m_values.size() == 2)
+		{
+			CHECK(sink.m_records[1].m_values[0] == "residential");
+			CHECK(sink.m_records[1].m_values[1] == "");
+		}
+	}
+	CHECK(converter.m_counts.m_nNodes == 3);
+	CHECK(converter.m_counts.m_nWays == 3);
+	CHECK(converter.m_counts.m_nWaysWritten == 2);
+}
+
+// Converting twice with the same converter gives the same counts and statistics rather than adding to the first run's
+void TestConvertTwice()
+{
+	OSM2MIFConfig config;
+	ParameterValues* highway = new ParameterValues(true);
+	highway->m_fIsAll = true;
+	config.m_mapIncludedValues["highway"] = highway;
+
+	OSMMemorySource source(szTwoWays, strlen(szTwoWays));
+	OSM2MIFConverter converter(config);
+	string strError;
+	CollectingSink first_sink, second_sink;
+	CHECK(converter.Convert(source, first_sink, strError));
+	OSM2MIFRunCounts first_counts = converter.m_counts;
+	CHECK(converter.Convert(source, second_sink, strError));
+
+	CHECK(second_sink.m_records.size() == first_sink.m_records.size());
+	CHECK(converter.m_counts.m_nLines == first_counts.m_nLines);
+	CHECK(converter.m_counts.m_nNodes == 3);
+	CHECK(converter.m_counts.m_nWaysWritten == 2);
+	CHECK(converter.m_counts.m_nBytesRead == first_counts.m_nBytesRead);
+
+	// each phase appears once in the statistics
+	const string strStatsFile = "OSM2MIFTest_stats.json";
+	CHECK(converter.m_stats.WriteJson(strStatsFile, strError));
+	ifstream in(strStatsFile.c_str());
+	stringstream json;
+	json << in.rdbuf();
+	in.close();
+	remove(strStatsFile.c_str());
+	size_t nFirst = json.str().find("\"node parse\"");
+	CHECK(nFirst != string::npos);
+	CHECK(nFirst == string::npos || json.str().find("\"node parse\"", nFirst + 1) == string::npos);
+}
+
+// A banned turn at the east edge of one shard's ways, into a way that goes far to the east: the node after the junction is
+// well outside the ways the first shard owns, but it must still be in its halo for the turn to be written
+const char* szBannedTurn =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<osm version=\"0.6\">\n"
+	" <node id=\"1\" lat=\"0.0\" lon=\"0.0\"/>\n"
+	" <node id=\"2\" lat=\"0.0\" lon=\"1.0\"/>\n"
+	" <node id=\"3\" lat=\"0.0\" lon=\"2.0\"/>\n"
+	" <node id=\"4\" lat=\"0.0\" lon=\"3.0\"/>\n"
+	" <node id=\"5\" lat=\"0.0\" lon=\"4.9\"/>\n"
+	" <node id=\"6\" lat=\"0.0\" lon=\"5.0\"/>\n"
+	" <node id=\"7\" lat=\"-3.0\" lon=\"9.0\"/>\n"
+	" <node id=\"8\" lat=\"0.0\" lon=\"9.5\"/>\n"
+	" <node id=\"9\" lat=\"0.0\" lon=\"9.6\"/>\n"
+	" <node id=\"10\" lat=\"0.0\" lon=\"9.7\"/>\n"
+	" <way id=\"100\">\n"
+	"  <nd ref=\"5\"/>\n"
+	"  <nd ref=\"6\"/>\n"
+	"  <tag k=\"highway\" v=\"primary\"/>\n"
+	" </way>\n"
+	" <way id=\"101\">\n"
+	"  <nd ref=\"6\"/>\n"
+	"  <nd ref=\"7\"/>\n"
+	"  <tag k=\"highway\" v=\"primary\"/>\n"
+	" </way>\n"
+	" <relation id=\"1\">\n"
+	"  <member type=\"way\" ref=\"100\" role=\"from\"/>\n"
+	"  <member type=\"node\" ref=\"6\" role=\"via\"/>\n"
+	"  <member type=\"way\" ref=\"101\" role=\"to\"/>\n"
+	"  <tag k=\"restriction\" v=\"no_right_turn\"/>\n"
+	"  <tag k=\"type\" v=\"restriction\"/>\n"
+	" </relation>\n"
+	"</osm>\n";
+
+// Two shards together write the same records, with the same banned turns, as a single conversion
+void TestShardedBannedTurn()
+{
+	OSM2MIFConfig config;
+	ParameterValues* highway = new ParameterValues(true);
+	highway->m_fIsAll = true;
+	config.m_mapIncludedValues["highway"] = highway;
+
+	OSMMemorySource source(szBannedTurn, strlen(szBannedTurn));
+	string strError;
+	CollectingSink single_sink;
+	{
+		OSM2MIFConverter converter(config);
+		CHECK(converter.Convert(source, single_sink, strError));
+	}
+	CHECK(single_sink.m_records.size() == 2);
+	if (single_sink.m_records.size() == 2)
+		CHECK(single_sink.m_records[0].m_strRestrictions == "101");
+
+	OSM2MIFShardPlan plan;
+	CHECK(PlanShards(source, config, 2, plan, strError));
+	CHECK(plan.m_shards.size() == 2);
+
+	vector<CollectingSink::CollectedRecord> sharded_records;
+	for (int i = 0; i < (int)plan.m_shards.size(); i++)
+	{
+		config.m_pShardPlan = &plan;
+		config.m_nShard = i;
+		OSM2MIFConverter converter(config);
+		CollectingSink sink;
+		CHECK(converter.Convert(source, sink, strError));
+		sharded_records.insert(sharded_records.end(), sink.m_records.begin(), sink.m_records.end());
+	}
+	config.m_pShardPlan = NULL;
+
+	CHECK(sharded_records.size() == single_sink.m_records.size());
+	for (int i = 0; i < (int)sharded_records.size() && i < (int)single_sink.m_records.size(); i++)
+	{
+		CHECK(sharded_records[i].m_rings == single_sink.m_records[i].m_rings);
+		CHECK(sharded_records[i].m_strRestrictions == single_sink.m_records[i].m_strRestrictions);
+	}
+}
+
+// Helpers to write small OSM documents for the multipolygon tests.  szNodes is a space separated list of node ids, szOuters and
+// szInners of way ids.
+string OSMNode(long id, double lat, double lon)
+{
+	char szLine[128];
+	sprintf(szLine, " <node id=\"%ld\" lat=\"%.7f\" lon=\"%.7f\"/>\n", id, lat, lon);
+	return szLine;
+}
+
+string OSMWay(long id, const char* szNodes)
+{
+	stringstream way;
+	way << " <way id=\"" << id << "\">\n";
+	stringstream nodes(szNodes);
+	long node_id;
+	while (nodes >> node_id)
+		way << "  <nd ref=\"" << node_id << "\"/>\n";
+	way << " </way>\n";
+	return way.str();
+}
+
+string OSMMultipolygon(long id, const char* szOuters, const char* szInners)
+{
+	stringstream relation;
+	relation << " <relation id=\"" << id << "\">\n";
+	const char* szRoles[] = { "outer", "inner" };
+	const char* szMembers[] = { szOuters, szInners };
+	for (int i = 0; i < 2; i++)
+	{
+		stringstream members(szMembers[i]);
+		long way_id;
+		while (members >> way_id)
+			relation << "  <member type=\"way\" ref=\"" << way_id << "\" role=\"" << szRoles[i] << "\"/>\n";
+	}
+	relation << "  <tag k=\"natural\" v=\"water\"/>\n  <tag k=\"type\" v=\"multipolygon\"/>\n </relation>\n";
+	return relation.str();
+}
+
+// Converts a document whose only included key is natural, with the member ways left untagged so only the relation is written
+bool ConvertMultipolygons(const string& strBody, CollectingSink& sink, OSM2MIFRunCounts& counts)
+{
+	string strDocument = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n" + strBody + "</osm>\n";
+	OSM2MIFConfig config;
+	ParameterValues* natural = new ParameterValues(true);
+	natural->m_fIsAll = true;
+	config.m_mapIncludedValues["natural"] = natural;
+	config.m_fProcessRelations = false;
+
+	OSMMemorySource source(strDocument.c_str(), strDocument.length());
+	OSM2MIFConverter converter(config);
+	string strError;
+	bool fOK = converter.Convert(source, sink, strError);
+	counts = converter.m_counts;
+	return fOK;
+}
+
+// The corners of the unit square, 1 to 4 anticlockwise from the origin
+string UnitSquareNodes()
+{
+	return OSMNode(1, 0, 0) + OSMNode(2, 0, 1) + OSMNode(3, 1, 1) + OSMNode(4, 1, 0);
+}
+
+// An outer ring split across three ways, listed out of order and one of them running backwards, is stitched into one closed ring
+void TestStitchReversedWays()
+{
+	CollectingSink sink;
+	OSM2MIFRunCounts counts;
+	CHECK(ConvertMultipolygons(UnitSquareNodes() + OSMWay(10, "1 2") + OSMWay(11, "3 2") + OSMWay(12, "3 4 1")
+							   + OSMMultipolygon(20, "12 10 11", ""), sink, counts));
+	CHECK(counts.m_nMultipolygonsWritten == 1);
+	CHECK(counts.m_nOpenRings == 0);
+	CHECK(sink.m_records.size() == 1);
+	if (sink.m_records.size() == 1)
+	{
+		CHECK(sink.m_records[0].m_fIsRegion);
+		CHECK(sink.m_records[0].m_rings.size() == 1);
+		if (sink.m_records[0].m_rings.size() == 1)
+		{
+			vector<pair<double,double> >& ring = sink.m_records[0].m_rings[0];
+			CHECK(ring.size() == 5);
+			CHECK(ring.size() > 0 && ring.front() == ring.back());
+		}
+	}
+}
+
+// Ways that don't close a ring are counted, and a multipolygon with no closed outer ring isn't written
+void TestOpenRing()
+{
+	CollectingSink sink;
+	OSM2MIFRunCounts counts;
+	CHECK(ConvertMultipolygons(UnitSquareNodes() + OSMWay(10, "1 2 3") + OSMWay(11, "3 4") + OSMMultipolygon(20, "10 11", ""), sink, counts));
+	CHECK(counts.m_nOpenRings == 1);
+	CHECK(counts.m_nMultipolygonsWritten == 0);
+	CHECK(sink.m_records.empty());
+}
+
+// An inner ring that touches its outer at a shared node, on the east or the west edge, is still a hole in that outer
+void TestInnerTouchingOuter()
+{
+	const char* szOuters[] = { "1 2 5 3 4 1", "1 2 3 4 5 1" };
+	for (int i = 0; i < 2; i++)
+	{
+		CollectingSink sink;
+		OSM2MIFRunCounts counts;
+		string strNodes = UnitSquareNodes() + OSMNode(5, 0.5, i == 0 ? 1 : 0) + OSMNode(6, 0.4, 0.5) + OSMNode(7, 0.6, 0.5);
+		CHECK(ConvertMultipolygons(strNodes + OSMWay(10, szOuters[i]) + OSMWay(11, "5 6 7 5") + OSMMultipolygon(20, "10", "11"), sink, counts));
+		CHECK(counts.m_nOrphanInnerRings == 0);
+		CHECK(sink.m_records.size() == 1 && sink.m_records[0].m_rings.size() == 2);
+	}
+}
+
+// An inner ring outside every outer ring is dropped and counted
+void TestOrphanInnerRing()
+{
+	CollectingSink sink;
+	OSM2MIFRunCounts counts;
+	string strNodes = UnitSquareNodes() + OSMNode(5, 5, 5) + OSMNode(6, 5, 6) + OSMNode(7, 6, 6);
+	CHECK(ConvertMultipolygons(strNodes + OSMWay(10, "1 2 3 4 1") + OSMWay(11, "5 6 7 5") + OSMMultipolygon(20, "10", "11"), sink, counts));
+	CHECK(counts.m_nOrphanInnerRings == 1);
+	CHECK(sink.m_records.size() == 1 && sink.m_records[0].m_rings.size() == 1);
+}
+
+// An inner ring inside two outer rings belongs to the smaller one, so it follows that outer in the region
+void TestInnerInSmallerOuter()
+{
+	CollectingSink sink;
+	OSM2MIFRunCounts counts;
+	string strNodes = OSMNode(1, 0, 0) + OSMNode(2, 0, 10) + OSMNode(3, 10, 10) + OSMNode(4, 10, 0)
+					  + OSMNode(5, 1, 1) + OSMNode(6, 1, 3) + OSMNode(7, 3, 3) + OSMNode(8, 3, 1)
+					  + OSMNode(9, 1.5, 1.5) + OSMNode(10, 1.5, 2) + OSMNode(11, 2, 2);
+	CHECK(ConvertMultipolygons(strNodes + OSMWay(100, "1 2 3 4 1") + OSMWay(101, "5 6 7 8 5") + OSMWay(102, "9 10 11 9")
+							   + OSMMultipolygon(200, "100 101", "102"), sink, counts));
+	CHECK(counts.m_nOrphanInnerRings == 0);
+	CHECK(sink.m_records.size() == 1);
+	if (sink.m_records.size() == 1)
+	{
+		vector<vector<pair<double,double> > >& rings = sink.m_records[0].m_rings;
+		CHECK(rings.size() == 3);
+		if (rings.size() == 3)
+		{
+			CHECK(rings[0].front() == make_pair(0.0, 0.0));
+			CHECK(rings[1].front() == make_pair(1.0, 1.0));
+			CHECK(rings[2].front() == make_pair(1.5, 1.5));
+		}
+	}
+}
+
+// Douglas-Peucker simplification keeps the ends and the fixed nodes, collapses straight runs and never leaves a region without a triangle
+void TestSimplifyLatLons()
+{
+	// a straight line of five nodes collapses to its ends
+	vector<pair<double,double> > line;
+	for (int i = 0; i < 5; i++)
+		line.push_back(make_pair(0.0, (double)i));
+	vector<bool> fixed(5, false);
+	CHECK(SimplifyLatLons(line, fixed, 0.01, false) == 3);
+	CHECK(line.size() == 2 && fixed.size() == 2);
+	CHECK(line.size() == 2 && line[0] == make_pair(0.0, 0.0) && line[1] == make_pair(0.0, 4.0));
+
+	// ... unless a node in it is fixed, as intersections are
+	line.clear();
+	for (int i = 0; i < 5; i++)
+		line.push_back(make_pair(0.0, (double)i));
+	fixed.assign(5, false);
+	fixed[2] = true;
+	CHECK(SimplifyLatLons(line, fixed, 0.01, false) == 2);
+	CHECK(line.size() == 3 && line[1] == make_pair(0.0, 2.0));
+	CHECK(fixed.size() == 3 && fixed[1] && !fixed[0] && !fixed[2]);
+
+	// a node further from the line than the tolerance stays, and one nearer goes
+	line.clear();
+	line.push_back(make_pair(0.0, 0.0));
+	line.push_back(make_pair(0.5, 1.0));
+	line.push_back(make_pair(0.251, 2.0));
+	line.push_back(make_pair(0.0, 3.0));
+	fixed.assign(4, false);
+	CHECK(SimplifyLatLons(line, fixed, 0.01, false) == 1);
+	CHECK(line.size() == 3 && line[1] == make_pair(0.5, 1.0) && line[2] == make_pair(0.0, 3.0));
+
+	// a small square with a large tolerance would lose all but its closing nodes, so it is left alone
+	vector<pair<double,double> > ring;
+	ring.push_back(make_pair(0.0, 0.0));
+	ring.push_back(make_pair(0.0, 0.001));
+	ring.push_back(make_pair(0.001, 0.001));
+	ring.push_back(make_pair(0.001, 0.0));
+	ring.push_back(make_pair(0.0, 0.0));
+	fixed.assign(5, false);
+	CHECK(SimplifyLatLons(ring, fixed, 1, true) == 0);
+	CHECK(ring.size() == 5);
+}
+
+// simplify= on the wildcard applies to every value of the key, and simplify= on a value overrides it for that value
+void TestSimplifyParameters()
+{
+	const string strParametersFile = "OSM2MIFTest_parameters.txt";
+	ofstream parameters(strParametersFile.c_str());
+	parameters << "mk=\"highway\" iv=\"*\" simplify=\"0.01\" iv=\"primary\" simplify=\"0.001\"" << endl;
+	parameters.close();
+
+	OSM2MIFConfig config;
+	string strError;
+	CHECK(config.ReadParametersFile(strParametersFile, strError));
+	remove(strParametersFile.c_str());
+	config.m_fProcessRelations = false;
+
+	// the same zigzag twice: 5 thousandths of a degree off the straight line
+	string strDocument = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n";
+	const char* szHighways[] = { "residential", "primary" };
+	for (int w = 0; w < 2; w++)
+		for (int i = 0; i < 4; i++)
+			strDocument += OSMNode(10 * w + i + 1, w + (i == 1 ? 0.005 : 0), i);
+	for (int w = 0; w < 2; w++)
+	{
+		char szNodes[64];
+		sprintf(szNodes, "%d %d %d %d", 10 * w + 1, 10 * w + 2, 10 * w + 3, 10 * w + 4);
+		string strWay = OSMWay(100 + w, szNodes);
+		strDocument += strWay.substr(0, strWay.find(" </way>")) + "  <tag k=\"highway\" v=\"" + szHighways[w] + "\"/>\n </way>\n";
+	}
+	strDocument += "</osm>\n";
+
+	OSMMemorySource source(strDocument.c_str(), strDocument.length());
+	CollectingSink sink;
+	OSM2MIFConverter converter(config);
+	CHECK(converter.Convert(source, sink, strError));
+	CHECK(sink.m_records.size() == 2);
+	if (sink.m_records.size() == 2)
+	{
+		CHECK(sink.m_records[0].m_values[0] == "residential" && sink.m_records[0].m_rings[0].size() == 2);
+		CHECK(sink.m_records[1].m_values[0] == "primary" && sink.m_records[1].m_rings[0].size() == 4);
+	}
+	CHECK(converter.m_counts.m_nNodesSimplifiedAway == 2);
+}
+
+// The compressed NodeStore gives back every node as it was added, across block boundaries and before and after the last block is
+// encoded, and finds nothing for the ids it doesn't have
+void TestCompressedNodeStore()
+{
+	NodeStore store(true);
+	vector<long> ids;
+	vector<pair<double,double> > latlons;
+	long id = 1;
+	for (int i = 0; i < 150; i++)
+	{
+		// alternating hemispheres make large negative and positive deltas, and one large gap in the ids
+		id += (i == 100 ? 1000000000L : 1 + i % 3);
+		int lat = (i % 2 == 0 ? -1 : 1) * (899999999 - i * 1234567), lon = (i % 3 == 0 ? -1 : 1) * (1799999999 - i * 7654321);
+		ids.push_back(id);
+		latlons.push_back(make_pair(lat / 1e7, lon / 1e7));
+		store.Add(id, lat / 1e7, lon / 1e7);
+	}
+	CHECK(store.Size() == 150);
+
+	// two full blocks and some nodes not yet encoded
+	pair<double,double> latlon;
+	bool fAllFound = true;
+	for (int i = 0; i < (int)ids.size(); i++)
+		fAllFound = fAllFound && store.Find(ids[i], latlon) && latlon == latlons[i];
+	CHECK(fAllFound);
+
+	// a node out of id order goes in the map, and a repeated id replaces the first location
+	store.Add(ids[10] + 1, -12.3456789, 98.7654321);
+	CHECK(store.Find(ids[10] + 1, latlon) && latlon == make_pair(-12.3456789, 98.7654321));
+	store.Add(ids[20], 1.5, -2.5);
+	CHECK(store.Find(ids[20], latlon) && latlon == make_pair(1.5, -2.5));
+	latlons[20] = make_pair(1.5, -2.5);
+	CHECK(store.Size() == 151);
+
+	// fill the last block, so it is encoded, and look everything up again
+	for (int i = 150; i < 3 * 64; i++)
+	{
+		id += 2;
+		ids.push_back(id);
+		latlons.push_back(make_pair(-i / 1e7, -i / 1e7));
+		store.Add(id, -i / 1e7, -i / 1e7);
+	}
+	fAllFound = true;
+	for (int i = (int)ids.size() - 1; i >= 0; i--)
+		fAllFound = fAllFound && store.Find(ids[i], latlon) && latlon == latlons[i];
+	CHECK(fAllFound);
+	CHECK(store.Size() == 3 * 64 + 1);
+
+	// ids before the first, in the gap, between two in a block and after the last are not found
+	latlon = make_pair(7.0, 7.0);
+	CHECK(!store.Find(0, latlon));
+	CHECK(!store.Find(ids[100] - 1, latlon));
+	CHECK(!store.Find(ids[180] - 1, latlon));
+	CHECK(!store.Find(id + 1, latlon));
+	CHECK(latlon == make_pair(7.0, 7.0));
+	CHECK(store.LatLon(id + 1) == make_pair(0.0, 0.0));
+}
+
+// A multipolygon whose outer ring leaves the bounding box through a way with no node inside it is still closed by the shard
+// that writes it, since the plan lists that way for the shard to keep
+void TestShardedMultipolygonOutsideBoundingBox()
+{
+	OSM2MIFConfig config;
+	ParameterValues* natural = new ParameterValues(true);
+	natural->m_fIsAll = true;
+	config.m_mapIncludedValues["natural"] = natural;
+	config.m_fProcessRelations = false;
+	config.m_min_lon = config.m_min_lat = -1;
+	config.m_max_lon = config.m_max_lat = 1;
+
+	// nodes 1, 5 and 6 are in the bounding box, way 11 is all outside it; nodes 7 and 8 give the second shard a strip
+	string strDocument = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n"
+						 + OSMNode(1, 0, 0) + OSMNode(2, 0, 5) + OSMNode(3, 5, 5) + OSMNode(4, 5, 0) + OSMNode(5, 0.5, 0.5)
+						 + OSMNode(6, 0.5, 0) + OSMNode(7, 0.9, 0.9) + OSMNode(8, 0.8, 0.9)
+						 + OSMWay(10, "1 6 5 2") + OSMWay(11, "2 3") + OSMWay(12, "3 4 1") + OSMMultipolygon(20, "10 11 12", "")
+						 + "</osm>\n";
+	OSMMemorySource source(strDocument.c_str(), strDocument.length());
+	string strError;
+
+	CollectingSink single_sink;
+	{
+		OSM2MIFConverter converter(config);
+		CHECK(converter.Convert(source, single_sink, strError));
+	}
+	CHECK(single_sink.m_records.size() == 1);
+
+	OSM2MIFShardPlan plan;
+	CHECK(PlanShards(source, config, 2, plan, strError));
+	CHECK(plan.m_shards.size() == 2);
+	if (plan.m_shards.size() == 2)
+	{
+		CHECK(plan.m_shards[0].m_outside_way_ids == vector<long>(1, 11));
+		CHECK(plan.m_shards[1].m_outside_way_ids.empty());
+	}
+
+	// the plan file keeps the ways' ids
+	const string strPlanFile = "OSM2MIFTest.plan";
+	OSM2MIFShardPlan read_plan;
+	CHECK(plan.Write(strPlanFile, strError) && read_plan.Read(strPlanFile, strError));
+	remove(strPlanFile.c_str());
+	CHECK(read_plan.m_shards.size() == 2);
+	if (read_plan.m_shards.size() == 2)
+		CHECK(read_plan.m_shards[0].m_outside_way_ids == plan.m_shards[0].m_outside_way_ids);
+
+	vector<CollectingSink::CollectedRecord> sharded_records;
+	for (int i = 0; i < (int)read_plan.m_shards.size(); i++)
+	{
+		config.m_pShardPlan = &read_plan;
+		config.m_nShard = i;
+		OSM2MIFConverter converter(config);
+		CollectingSink sink;
+		CHECK(converter.Convert(source, sink, strError));
+		CHECK(converter.m_counts.m_nOpenRings == 0);
+		sharded_records.insert(sharded_records.end(), sink.m_records.begin(), sink.m_records.end());
+	}
+	config.m_pShardPlan = NULL;
+
+	CHECK(sharded_records.size() == 1);
+	if (sharded_records.size() == 1 && single_sink.m_records.size() == 1)
+		CHECK(sharded_records[0].m_rings == single_sink.m_records[0].m_rings);
+}
+
+int main(int /*argc*/, char* /*argv*/[])
+{
+	TestProgrammaticConfig();
+	TestConvertTwice();
+	TestShardedBannedTurn();
+	TestStitchReversedWays();
+	TestOpenRing();
+	TestInnerTouchingOuter();
+	TestOrphanInnerRing();
+	TestInnerInSmallerOuter();
+	TestSimplifyLatLons();
+	TestSimplifyParameters();
+	TestCompressedNodeStore();
+	TestShardedMultipolygonOutsideBoundingBox();
+
+	cout << nChecks - nFailures << " of " << nChecks << " checks passed" << endl;
+	return nFailures == 0 ? 0 : 1;
+}